@@ -53,6 +53,26 @@ uint32_t SCoopGetSP() { register uint32_t val; asm ("mov     %[temp],sp" : [temp
 
 #endif
 
+#if defined(SCoop_HOST) && (SCoop_HOST == 1)
+
+static void SCoopSwitch(uint8_t **newSP, uint8_t **oldSP) __attribute__((naked,noinline)) ;
+static void SCoopSwitch(uint8_t **newSP, uint8_t **oldSP)   // x86-64 system V : newSP in rdi, oldSP in rsi
+{ asm volatile ("push    %rbp \n\t push %rbx \n\t push %r12 \n\t push %r13 \n\t push %r14 \n\t push %r15");
+  asm volatile ("mov     %rsp, (%rsi) \n\t"
+                "mov     (%rdi), %rsp");
+  asm volatile ("pop     %r15 \n\t pop %r14 \n\t pop %r13 \n\t pop %r12 \n\t pop %rbx \n\t pop %rbp \n\t ret");
+};
+
+static inline uintptr_t SCoopGetSP() __attribute__ ((always_inline)) ;
+uintptr_t SCoopGetSP() { register uintptr_t val; asm volatile ("mov     %%rsp,%[temp]" : [temp] "=r" (val)); return val; }
+
+#define ARM_ATOMIC ASM_ATOMIC                  // no interrupt on the host, but keeps the same code path as ARM
+#define AVR_ATOMIC 
+
+#define SCoopMicros()   ((micros_t)micros())
+
+#endif
+
 #if defined(SCoop_AVR) && (SCoop_AVR == 1)
 
 static void SCoopSwitch(void *newSP, void *oldSP) __attribute__((naked,noinline));
@@ -229,6 +249,150 @@ static inline micros_t SCoopMicros16(void) // same as standrad PJRC micros, but
 
 #endif
 
+#if SCoopVIRTUALCLOCK > 0
+
+/********* VIRTUAL CLOCK *******/
+
+static uint32_t SCoopVirtualMs  = 0;           // time of the virtual clock
+static uint32_t SCoopVirtualUs  = 0;
+static uint16_t SCoopVirtualSub = 0;           // micro seconds not yet accounted in SCoopVirtualMs
+
+uint32_t SCoopVirtualMillis() { return SCoopVirtualMs; }
+uint32_t SCoopVirtualMicros() { return SCoopVirtualUs; }
+
+void SCoopVirtualAdvance(uint32_t us)
+{ SCoopVirtualUs += us;
+  us += SCoopVirtualSub;
+  SCoopVirtualMs += us / 1000;
+  SCoopVirtualSub = us % 1000; }
+
+void SCoopVirtualAdvanceMillis(uint32_t ms)
+{ SCoopVirtualMs += ms;
+  SCoopVirtualUs += ms * 1000; }
+
+SCoopTimeFunc_t SCoopMillisSource = SCoopVirtualMillis;
+SCoopTimeFunc_t SCoopMicrosSource = SCoopVirtualMicros;
+
+#undef  SCoopMicros
+#define SCoopMicros()   ((micros_t)SCoopMicrosSource())  // all the library time now comes from the pluggable source
+
+#define SCoopVirtualCharge() { if (SCoopMicrosSource == SCoopVirtualMicros) SCoopVirtualAdvance(SCINM.virtualCostMicros); }
+#else
+#define SCoopVirtualCharge()
+#endif
+
+/********* CACHED TIME *******/
+
+#if SCoopCACHEDTIME > 0
+SCDelay_t SCoopNowMillis = 0;
+micros_t  SCoopNowMicros = 0;
+
+void SCoopTimeRefresh()                        // all the delays read these values until next refresh
+{ SCoopNowMillis = SCoopDelayMillis();
+  SCoopNowMicros = SCoopMicros(); }
+#define SCoopCachedMicros() SCoopNowMicros
+#else
+#define SCoopCachedMicros() SCoopMicros()
+#endif
+
+
+/********* DEFERRED CALLS FROM ISR *******/
+// an ISR reserves a slot by moving SCoopDeferIn (compare and swap on ARM where interrupts can nest,
+// a few cycles with interrupts off on AVR), then writes arg and publishes func. the main loop is the only consumer :
+// it stops on the first slot not yet published and frees each slot by clearing func before moving SCoopDeferOut
+
+#if SCoopDEFERSIZE > 0
+#if (SCoopDEFERSIZE & (SCoopDEFERSIZE - 1)) || (SCoopDEFERSIZE > 128)
+#error "SCoopDEFERSIZE must be a power of 2, up to 128"
+#endif
+
+struct SCoopDeferItem_t { volatile SCoopDeferFunc_t func; volatile ptrInt arg; };
+
+static SCoopDeferItem_t SCoopDeferQueue[SCoopDEFERSIZE];
+static vui8  SCoopDeferIn  = 0;
+static vui8  SCoopDeferOut = 0;
+vui16        SCoopDeferLost = 0;
+
+bool SCoopDefer(SCoopDeferFunc_t func, ptrInt arg)
+{ register uint8_t in;
+#if defined(SCoop_ARM) || defined(SCoop_HOST)
+  do { in = SCoopDeferIn;
+       if ((uint8_t)(in - SCoopDeferOut) >= SCoopDEFERSIZE) { SCoopDeferLost++; return false; } }
+  while (!__sync_bool_compare_and_swap(&SCoopDeferIn, in, (uint8_t)(in + 1)));
+#else
+  register bool full;
+  AVR_ATOMIC { in = SCoopDeferIn;
+               full = ((uint8_t)(in - SCoopDeferOut) >= SCoopDEFERSIZE);
+               if (full) SCoopDeferLost++; else SCoopDeferIn = in + 1; }
+  if (full) return false;
+#endif
+  register SCoopDeferItem_t* item = &SCoopDeferQueue[in & (SCoopDEFERSIZE - 1)];
+  item->arg  = arg;
+  item->func = func;                           // published
+  return true; }
+
+uint8_t SCoopDeferCount()
+{ return (uint8_t)(SCoopDeferIn - SCoopDeferOut); }
+
+static void SCoopDeferRun()                    // called by the main loop yield() only. no more than the queue size each time
+{ register uint8_t n = SCoopDEFERSIZE;
+  do { register SCoopDeferItem_t* item = &SCoopDeferQueue[SCoopDeferOut & (SCoopDEFERSIZE - 1)];
+       register SCoopDeferFunc_t func = item->func;
+       if (func == NULL) return;               // empty, or the ISR has not finished writing it
+       register ptrInt arg = item->arg;
+       item->func = NULL;
+       SCoopDeferOut++;
+       func(arg);
+     } while (--n); }
+#endif
+
+
+/********* TICKS : TIME BASE FOR QUANTUM CHECK AND TASK TIME MEASUREMENT *******/
+// on ARM the DWT cycle counter is read with a single load, which is much cheaper than micros() at each yield()
+// the conversion to micro seconds is only done on time differences, when the task really switches
+
+#if SCoopTICKCYCLES > 0
+
+#define SCoopDEMCR       (*(volatile uint32_t*)0xE000EDFC)  // debug exception and monitor control
+#define SCoopDWT_CTRL    (*(volatile uint32_t*)0xE0001000)
+#define SCoopDWT_CYCCNT  (*(volatile uint32_t*)0xE0001004)
+#define SCoopSYST_RVR    (*(volatile uint32_t*)0xE000E014)  // systick reload value
+#define SCoopSYST_CVR    (*(volatile uint32_t*)0xE000E018)  // systick current value (counting down)
+#define SCoopSCB_ICSR    (*(volatile uint32_t*)0xE000ED04)
+
+static bool SCoopHasDWT = false;
+
+static void SCoopTicksInit()                  // enable the cycle counter, and check that it is really counting
+{ SCoopDEMCR    |= (1UL << 24);               // TRCENA
+  SCoopDWT_CTRL |= 1;                         // CYCCNTENA
+  register uint32_t first = SCoopDWT_CYCCNT;
+  asm volatile ("nop \n\t nop \n\t nop \n\t nop");
+  SCoopHasDWT = (SCoopDWT_CYCCNT != first); }
+
+static uint32_t SCoopSysTickCycles() __attribute__((noinline));
+static uint32_t SCoopSysTickCycles()          // fallback : same approach as the core micros(), but keeping cpu cycles
+{ register uint32_t ms, count;
+  ASM_ATOMIC {
+     count = SCoopSYST_CVR; ms = millis();
+     if ((SCoopSCB_ICSR & (1UL << 26)) && (count > (SCoopSYST_RVR >> 1))) ms++; } // systick wrapped, millis interrupt still pending
+  return ms * (SCoopSYST_RVR + 1) + (SCoopSYST_RVR - count); }
+
+static inline micros_t SCoopTicks() __attribute__((always_inline));
+static inline micros_t SCoopTicks()
+{ if (SCoopHasDWT) return (micros_t)SCoopDWT_CYCCNT;
+  return (micros_t)SCoopSysTickCycles(); }
+
+#define SCoopCyclesPerMicro    (F_CPU / 1000000L)
+#define SCoopTicksToMicros(x)  ((x) / SCoopCyclesPerMicro)
+#define SCoopMicrosToTicks(x)  ((x) * SCoopCyclesPerMicro)
+
+#else
+#define SCoopTicksInit()
+#define SCoopTicks()           SCoopMicros()
+#define SCoopTicksToMicros(x)  (x)
+#define SCoopMicrosToTicks(x)  (x)
+#endif
+
 /********* SCOOPEVENT METHODS *******/
 
 SCoopEvent::SCoopEvent()
@@ -240,6 +404,9 @@ SCoopEvent::SCoopEvent()
 { pNext = SCoopFirstItem;                      // memorize the latest item registered
   SCoopFirstItem = this;                       // point the latest item to this one
   itemType = type;                             // just to memorize the object type, as we use polymorphism 
+#if SCoopEVENTCOUNT > 0
+  pending = 0; countMode = SCoopCOUNTNONE;
+#endif
   state = SCoopCONSTRUCTED; }                  // we are in the list and ready for a formal "init", either in the skecth or as a constructor extension
     
 
@@ -248,16 +415,20 @@ SCoopEvent::SCoopEvent(SCoopFunc_t func)
   registerThis(SCoopEventType); }
   
 SCoopEvent::~SCoopEvent()                      // destructor : remove item from the list
-{ unregisterThis(); 
+{ if (SCINM.Current == this) SCINM.Current = pNext; // deleted from the main loop while next in the cycle
+  unregisterThis(); 
 if (SCoopFirstTaskItem == this) SCoopFirstTaskItem = pNext; // we do not need to change this if this is not the first task 
 // below section should be in Task Destructor, but didnt work there, probleme with chaining... so I put it here...
 if ((itemType == SCoopDynamicTask) || (itemType == SCoopTaskType)) {
     SCINM.targetCycleMicros -= reinterpret_cast<SCoopTask*>(this)->quantumMicros; // reduce target cycle time
 	SCoopNumberTask--;	
+#if SCoopEDF > 0
+	reinterpret_cast<SCoopTask*>(this)->clearPeriod();
+#endif
 #if SCoopYIELDCYCLE == 0	
 	if (SCoopNumberTask>0) { SCINM.quantumMicrosReal = quantumMicros / SCoopNumberTask; }
 #endif	
-#if SCoopANDROIDMODE >=2
+#if SCoopANDROIDMODE >=1                         // a startLoop() task can also be deleted without kill()
 if (itemType == SCoopDynamicTask)  { 
    free(reinterpret_cast<SCoopTask*>(this)->pStackAddr); }
 #endif
@@ -293,6 +464,23 @@ bool SCoopEvent::launch() {                    // launch or switch into this ite
 //ifSCoopTRACE(2,"Event::launch");             // removed. too much printing !
 
   if (state & SCoopPAUSED) return false;       // check if item is suspended or not
+#if SCoopEVENTCOUNT > 0
+  if (countMode) {
+     register uint8_t count;
+#if defined(SCoop_ARM) || defined(SCoop_HOST)
+     count = __sync_lock_test_and_set(&pending, 0);
+#else
+     AVR_ATOMIC { count = pending; pending = 0; }
+#endif
+     if (count == 0) { state &= ~SCoopTRIGGER; return false; }
+     SCoopATOMIC {
+     state = SCoopRUNNING;
+     if (countMode == SCoopCOUNTALL) { triggers = count; run(); }
+     else { triggers = 1; do run(); while (--count); }
+     state = SCoopRUNNABLE;
+     if (pending) state |= SCoopTRIGGER; }     // set() again during run()
+     return true; }
+#endif
   if (!(state & SCoopTRIGGER)) return false;
   SCoopATOMIC {
   state = SCoopRUNNING;                        // this also clear the trigger flag at the same time :)
@@ -302,6 +490,20 @@ bool SCoopEvent::launch() {                    // launch or switch into this ite
  };   
 
 
+#if SCoopEVENTCOUNT > 0
+void SCoopEvent::countUp()                     // called by set(), maybe from an ISR
+{
+#if defined(SCoop_ARM) || defined(SCoop_HOST)
+  register uint8_t count;
+  do { count = pending; if (count == 255) return; }
+  while (!__sync_bool_compare_and_swap(&pending, count, (uint8_t)(count + 1)));
+#else
+  AVR_ATOMIC { if (pending != 255) pending++; }
+#endif
+}
+#endif
+
+
 #if SCoopTRACE > 0
 void SCoopEvent::traceThis() {                 // declare the trace functions for debuging or printing some info by user
      SCp("this=");SCphex((ptrInt)this & 0xFFFF);
@@ -322,160 +524,62 @@ bool SCoopEvent::paused()                      // just return the pause flag sta
 { if (state & SCoopPAUSED) return true; else return false; } 
 
 
-/********* SCoopDelay CLASS *******/               // a basic virtual timer implementation. sort of "timerdown"
-                                               // very small size code in each method. compiler will probably inline and clone everything
-SCoopDelay::SCoopDelay()                
-{ reset(); }
-  
-SCoopDelay::SCoopDelay(SCDelay_t reload) 
-{ set(setReload(reload)); }
-
-SCDelay_t  SCoopDelay::setReload(SCDelay_t reload) 
-{ return (reloadValue = reload); }
-
-SCDelay_t SCoopDelay::getReload()    
-{ return reloadValue; }
-
-void SCoopDelay::initReload()       
-{ set(reloadValue); }
-
-void SCoopDelay::reload()           
-{ timeValue += reloadValue; }
-
-bool SCoopDelay::reloaded()
-{ if (elapsed()) {
-     reload();
-	 return true; }
-  return false; }
-
-void SCoopDelay::reset()
-{ set(0); }
-
-SCDelay_t SCoopDelay::set(SCDelay_t time)
-{ return (timeValue = time + SCoopDelayMillis()); };
-
-SCDelay_t SCoopDelay::get()
-{ register SCDelay_t temp =(timeValue - SCoopDelayMillis()); 
-  if (temp <0) return 0; else return temp; }
+/********* SCoopDelayus METHODS *******/
 
-SCDelay_t SCoopDelay::add(SCDelay_t time)
-{ timeValue += time; return time; }
+template <class T> T SCoopDelayusT<T>::set(T time) // here rather than in SCoop.h, as SCoopMicros() is only known here
+{ SCoopTimeRefresh();
+  return (timeValue = time + (T)SCoopCachedMicros()); }
 
-SCDelay_t SCoopDelay::sub(SCDelay_t time)
-{ timeValue -= time; return time; }
-
-bool SCoopDelay::elapsed()
-{ return (get() == 0); }
-
-
-/********* SCoopDelayUS CLASS *******/               // a basic virtual timer implementation. sort of "timerdown"
-                                               // very small size code in each method. compiler will probably inline and clone everything
-SCoopDelayus::SCoopDelayus()                
-{ reset(); }
-  
-SCoopDelayus::SCoopDelayus(micros_t reload) 
-{ set(setReload(reload)); }
-
-micros_t  SCoopDelayus::setReload(micros_t reload) 
-{ return (reloadValue = reload); }
-
-micros_t SCoopDelayus::getReload()    
-{ return reloadValue; }
-
-void SCoopDelayus::initReload()       
-{ set(reloadValue); }
-
-void SCoopDelayus::reload()           
-{ timeValue += reloadValue; }
-
-bool SCoopDelayus::reloaded()
-{ if (elapsed()) {
-     reload();
-	 return true; }
-  return false; }
-
-void SCoopDelayus::reset()
-{ set(0); }
-
-micros_t SCoopDelayus::set(micros_t time)
-{ return (timeValue = time + SCoopMicros()); };
-
-micros_t SCoopDelayus::get()
-{ register micros_t temp =(timeValue - SCoopMicros()); 
-  if (temp <0) return 0; else return temp; }
-
-micros_t SCoopDelayus::add(micros_t time)
-{ timeValue += time; return time; }
-
-micros_t SCoopDelayus::sub(micros_t time)
-{ timeValue -= time; return time; }
-
-bool SCoopDelayus::elapsed()
-{ return (get() == 0); }
+template <class T> T SCoopDelayusT<T>::get()
+{ register T temp = (T)(timeValue - (T)SCoopCachedMicros());
+  if (temp < 0) return 0; else return temp; }
 
+template class SCoopDelayusT<int8_t>;          // every width allowed by SCoopDelayusT, see SCoop.h
+template class SCoopDelayusT<int16_t>;
+#if !defined(SCoop_AVR)
+template class SCoopDelayusT<int32_t>;         // micros_t is 32 bits
+#endif
 
 
 /********* SCoopTimer METHODS *******/
+                                               // the width dependent part is in the SCoopTimerT template, in SCoop.h
 
 
-SCoopTimer::SCoopTimer() : SCoopEvent()
-{initBasic(); init(0,NULL); };
-
-SCoopTimer::SCoopTimer(SCDelay_t period) : SCoopEvent()
-{initBasic(); init(period, NULL); };
-
-SCoopTimer::SCoopTimer(SCDelay_t period, SCoopFunc_t func) : SCoopEvent()
-{initBasic(); init( period, func); }
-
-void SCoopTimer::initBasic() {
-  counter    = -1; 
+SCoopTimerBase::SCoopTimerBase() : SCoopEvent()
+{
+#if SCoopTIMERSLACK > 0
+  slackMillis = 0;
+#endif
   userFunc   = NULL;
   itemType   = SCoopTimerType; };
 
-void SCoopTimer::init(SCDelay_t period, SCoopFunc_t func) {
-  timer.setReload(period); timer.reset(); 
-  userFunc = func; 
-  if (func != NULL) 
-     state = SCoopNEW; } // we can use this NEW state as the user function is now defined
-
-
-void SCoopTimer::start() { 
-  ifSCoopTRACE(3,"Timer::start");
-  SCoopEvent::start(); 
-  timer.initReload();   // make sure the timer is starting with the reload period value
-  }
-
-
-bool SCoopTimer::launch() 
-{ if ((counter == 0) || (timer.getReload() == 0)) return false;
-  if (timer.reloaded()) {
-       
-//ifSCoopTRACE(3,"Timer::launch/run");  // removed too much printing
-
-	 state |= SCoopTRIGGER;
-	 register bool launched = SCoopEvent::launch();
-	 if ((launched ) && (counter > 0)) counter--;   
-       	     
-	     return launched; }                    // rearm next run time so timers are NOT desynchronized by pause(). (my default choice)       
-    
-  return false; };
-
 
-SCDelay_t SCoopTimer::getTimeToRun() 
-{ if ((counter == 0) || (timer.getReload() == 0)) return -1;
-  return timer.get(); };
+#if SCoopTIMERSLACK > 0
+void SCoopTimerBase::alignPhase()               // first deadline chosen so that every deadline of one of us is also a deadline of the other
+{ register SCDelay_t period = getPeriod();
+  if (period <= 0) return;
+  register SCoopEvent* ptr = SCoopFirstItem;
+  while (ptr != SCoopFirstTaskItem) {
+    if ((ptr != this) && (ptr->itemType == SCoopTimerType) && (ptr->state & SCoopRUNNABLE)) {
+       register SCoopTimerBase* other = reinterpret_cast<SCoopTimerBase*>(ptr);
+       register SCDelay_t otherPeriod = other->getPeriod();
+       register SCDelay_t otherLeft = other->getTimeToRun(); // -1 if its counter is spent
+       if (other->slackMillis && (otherLeft >= 0) && (otherPeriod > 0)) {
+          register SCDelay_t left = -1;
+          if ((otherPeriod % period) == 0) left = otherLeft % period;
+          else if ((period % otherPeriod) == 0) left = otherLeft;
+          if (left >= 0) { setTimeToRun(left ? left : period); return; } } }
+    ptr = ptr->pNext; } }
 
 
-void SCoopTimer::setTimeToRun(SCDelay_t time)
-{ timer.set(time); };
+void SCoopTimerBase::batchDue()
+{ if (!SCINM.timerBatch) SCINM.timerWakeups++;
+  SCINM.timerBatch = true; SCINM.timerBatchNext = true; }
 
 
-void SCoopTimer::schedule(SCDelay_t time, SCoopTimerCount_t count)
-{ timer.set(timer.setReload(time)); counter = count; };
-
-
-void SCoopTimer::schedule(SCDelay_t time)
-{ schedule(time,-1); };
+bool SCoopTimerBase::batchEarly(SCDelay_t left)
+{ return (SCINM.timerBatch && !(state & SCoopPAUSED) && (left <= slackMillis)); }
+#endif
 
 
 /********* SOME BASIC FUNCTIONS *******/
@@ -510,6 +614,21 @@ void SCoopTask::initBasic() {
    pStackAddr = NULL;
    pStack     = NULL;
    userFunc   = NULL;
+#if SCoopSHAREDSTACK > 0
+   shared     = NULL; savePeak = 0;
+#endif
+#if SCoopADAPTIVEQUANTUM > 0
+   minQuantumMicros = 0; maxQuantumMicros = 0;  // user can set them in setup(), otherwise calculated by start()
+#endif
+#if SCoopEDF > 0
+   periodMillis = 0; utilization = 0; costMicros = 0; deadlineMisses = 0; jobTicks = 0;
+#endif
+#if SCoopSTRIDE > 0
+   setShare(SCoopSTRIDEDEFAULT); pass = 0;
+#if SCoopTIMEREPORT > 0
+   spentMicros = 0;
+#endif
+#endif
    register SCoopEvent* ptr = pNext;           // point on the previous item registered in the standard item list (if any)    
    pNext = SCoopFirstTaskItem;                 // register in the task list     
    SCoopFirstTaskItem = this; 
@@ -525,6 +644,8 @@ void SCoopTask::init(SCoopStack_t* stack, ptrInt size)
   pStack = (uint8_t*)stack + ((size-sizeof(SCoopStack_t))         // prepare task stack to the top of the space provided
 #if defined(SCoop_ARM) && (SCoop_ARM == 1)
   & ~7
+#elif defined(SCoop_HOST)
+  & ~15
 #endif
   );
   SCoopMemFill((uint8_t*)stack, pStack, 0x55); // fill with 0x55 patern in order to calculate StackLeft later
@@ -538,6 +659,15 @@ void SCoopTask::init(SCoopStack_t* stack, ptrInt size, SCoopFunc_t func) // only
      state = SCoopNEW; }                       // we have a stack and a user function so we can "start" later.
 
 
+#if SCoopSHAREDSTACK > 0
+void SCoopTask::shareStack(SCoopSharedStack& shared, SCoopStack_t* save, ptrInt saveSize)
+{ this->shared = &shared;
+  saveAddr = (uint8_t*)save; this->saveSize = saveSize;
+  pStackAddr = shared.bottom;                  // stackLeft() then gives the space left in the shared stack
+  pStack = shared.top; }
+#endif
+
+
 SCoopTask::~SCoopTask(){ }                     // destructor to remove task from list .. doesnt really work with "delete"
 
 
@@ -555,11 +685,22 @@ void SCoopTask::trace(char * xx) {
 
 /******** START and LAUNCH SECTION ****************/
 
+#if SCoopPREEMPT > 0                                 // the switches are done with interrupts off : each context gets its own
+#define SCoopPREEMPTLOCK AVR_ATOMIC                  // SREG back when the block is left, and a task switched by the isr
+#else                                                // keeps interrupts off until its "reti"
+#define SCoopPREEMPTLOCK
+#endif
+
 
 void SCoopTask::start() {
  ifSCoopTRACE(3,"Task::start");
  if (pStack) {                                       // sanity check if stack has been allocated by user or constructor ...
      if ((state & SCoopNEW)) {                       // if the task context is not yet set
+#if SCoopSHAREDSTACK > 0
+       if (shared) {                                 // the first context is built directly in the shared stack
+          if (!shared->evict()) return;              // try again at next launch()
+          shared->owner = this; pStack = shared->top; }
+#endif
        ASM_ATOMIC {                                  // de activate interrupt so we can use the stack content for further copy/paste
 	     SCoopSwitch(&SCINM.mainEnv,&SCINM.mainEnv);   // simulate switching but with current context : back to same place !                                               
                                      
@@ -577,19 +718,34 @@ void SCoopTask::start() {
      SCoopEvent::start();                            // call the user setup function (if defined in derived object) and set object RUNNABLE     
 	 quantumMicros = SCINM.startQuantum;             // initialize quantum time provided by start (xx) or by user or by default
 	 SCINM.targetCycleMicros += quantumMicros;       // cumulate time to calculate target cycle time
-	 prevMicros = SCoopMicros();                     // memorize time , to calculate time spent in the task and in the cycle
+#if SCoopADAPTIVEQUANTUM > 0
+	 shareMicros = quantumMicros; cycleTicks = 0;
+	 if (!minQuantumMicros) minQuantumMicros = shareMicros >> 2;
+	 if (!maxQuantumMicros) { maxQuantumMicros = shareMicros << 1;
+	    if (maxQuantumMicros < shareMicros) maxQuantumMicros = shareMicros; } // 16 bits overflow on AVR
+#endif
+	 prevMicros = SCoopTicks();                      // memorize time , to calculate time spent in the task and in the cycle
      timer = 0; }                                    // this will enable imediate user call to sleepSync to work properly  
 } // end start()
 
 
 void SCoopTask::startFirstLoop() {                   // will execute this function the first call to backToTask() made by yield()
+#if SCoopPREEMPT > 0
+  interrupts();                                      // we come from the locked switch in launch()
+#endif
 #if SCoopTIMEREPORT > 0
   yieldMicros    = 0; maxYieldMicros = 0; 
+#if SCoopTICKCYCLES > 0
+  yieldCycles    = 0;
+#endif
 #endif  
   state = SCoopRUNNING;                   
   while (true)  {                                    // a SCoop task will never end ...
      if (!(state & SCoopPAUSED)) {
          loop();                                     // call user function (derived virtual loop or user adress)
+#if SCoopEDF > 0
+         if (periodMillis) { endJob(); continue; }   // periodic task : come back only for the next release
+#endif
 		 yieldInline(quantumMicros); }               // try to switch task if we reach the end of the user loop
      else yield(0);                                  // switch imediately to next task (or scheduler) if we are paused
     }
@@ -600,10 +756,18 @@ bool SCoopTask::launch() {
 //  ifSCoopTRACE(3,"task::launch")	
 	if (state & SCoopRUNNABLE) {                   // make sure the task context is setup first and start() has been called already 
        if (!(state & (SCoopPAUSED | SCoopKILLING))) 
-	      { SCINM.Task = this;                     // we always can find a pointer to the current task in which we are running
-            SCoopSwitch(&pStack,&SCINM.mainEnv);
+	      {
+#if SCoopSHAREDSTACK > 0
+            if (shared && (shared->owner != this)) { // take the shared stack : save the owner, restore our bytes
+               if (!shared->evict()) { prevMicros = SCoopTicks(); return false; }
+               memcpy(pStack, saveAddr, shared->top - pStack + 1);
+               shared->owner = this; shared->swaps++; }
+#endif
+            SCoopPREEMPTLOCK {
+            SCINM.Task = this;                     // we always can find a pointer to the current task in which we are running
+            SCoopSwitch(&pStack,&SCINM.mainEnv); }
 		    return true; }                         // return to scheduler / yield() or cycle()
-	   else prevMicros = SCoopMicros();            // just to avoid jeopardizing the cycleMicros in fact
+	   else prevMicros = SCoopTicks();             // just to avoid jeopardizing the cycleMicros in fact
 	} else 
 	   if (state & SCoopNEW) start();              // initialize context if not done in the main arduino setup() section ...
   return false; }                               
@@ -629,9 +793,10 @@ void SCoopTask::kill()
 
   
   void SCoopTask::yieldInline(micros_t quantum)
-  { if (quantum) {
-       register micros_t spent = SCoopMicros() - prevMicros;
-       if (spent >= quantum) yieldSpent(spent);  }   // switch makes sense	   
+  { SCoopVirtualCharge();
+    if (quantum) {
+       register micros_t spent = SCoopTicks() - prevMicros;
+       if (spent >= SCoopMicrosToTicks(quantum)) yieldSpent(SCoopTicksToMicros(spent));  }   // switch makes sense	   
     else if (!SCINM.Atomic) yieldSwitch();
 };     
   
@@ -647,9 +812,38 @@ void SCoopTask::kill()
    
    void SCoopTask::yieldSwitch() { 
 	register SCoopEvent* temp;
-	if ((SCoopYIELDCYCLE == 1) &&                    // optimize speed by directly switching next adjacent task
+#if ((SCoopTIMEREPORT > 0) && (SCoopTICKCYCLES > 0)) || (SCoopADAPTIVEQUANTUM > 0) || (SCoopEDF > 0) || (SCoopSTRIDE > 0)
+	{ register micros_t ticks = SCoopTicks() - prevMicros; // accounting done here, whatever the reason of the switch
+#if (SCoopTIMEREPORT > 0) && (SCoopTICKCYCLES > 0)
+	yieldCycles += ticks;
+#endif
+#if SCoopADAPTIVEQUANTUM > 0
+	cycleTicks  += ticks;
+#endif
+#if SCoopEDF > 0
+	jobTicks    += ticks;
+#endif
+#if SCoopSTRIDE > 0
+	{ register uint32_t spent = SCoopTicksToMicros(ticks);
+	pass        += spent * stride;
+#if SCoopTIMEREPORT > 0
+	spentMicros += spent;
+#endif
+	}
+#endif
+	}
+#endif
+	SCoopPREEMPTLOCK {                               // no preemption while the task pointers and contexts are changing
+	if ((SCoopYIELDCYCLE == 1) && (SCoopSTRIDE == 0) && // optimize speed by directly switching next adjacent task
 	   ((temp=pNext) != NULL) &&                     // only if possible, otherwise back to main loop
-       ((temp->state & (SCoopRUNNABLE | SCoopPAUSED | SCoopKILLING)) == SCoopRUNNABLE))	{   
+       ((temp->state & (SCoopRUNNABLE | SCoopPAUSED | SCoopKILLING)) == SCoopRUNNABLE)
+#if SCoopEDF > 0                                     // periodic tasks are only launched by the scheduler
+       && (!periodMillis) && (!((SCoopTask*)temp)->periodMillis) && (!SCINM.edfPending())
+#endif
+#if SCoopSHAREDSTACK > 0                             // the stack copies are done by launch(), from the main stack
+       && (!shared) && (!((SCoopTask*)temp)->shared)
+#endif
+       )	{   
            SCINM.Current = temp;                  
            SCINM.Task = (SCoopTask*)temp;          // lets go next
            SCoopSwitch(&(((SCoopTask*)temp)->pStack),&pStack); }    // save our context and use next one
@@ -657,9 +851,99 @@ void SCoopTask::kill()
         SCINM.Task = NULL;                          
         SCoopSwitch(&SCINM.mainEnv,&pStack);  }      // save context and return to main scheduler
 													 // will return here by launch() from scheduler yield() or cycle()
-     prevMicros = SCoopMicros();
+     prevMicros = SCoopTicks(); }
 	};                                               // come back into the task HERE / NOW
 
+#if SCoopPREEMPT > 0
+/******** PREEMPTION SECTION ****************/
+
+void SCoopPreempt()                                  // interrupts are off : same checks as yield(), but forced
+{ register SCoopTask* task = SCINM.Task;
+  if ((task == NULL) || SCINM.Atomic || (task->quantumMicros == 0)) return; // main loop, atomic section or no quantum
+  register micros_t spent = SCoopTicks() - task->prevMicros;
+  if (spent < SCoopMicrosToTicks(task->quantumMicros)) return;
+  SCINM.preemptions++;
+  task->yieldSpent(SCoopTicksToMicros(spent)); }     // back here when the task is launched again, then "reti"
+
+ISR(TIMER0_COMPB_vect) { SCoopPreempt(); }          // timer0 is running for millis() : compare B is free, once per overflow
+#endif
+
+#if SCoopSTRIDE > 0
+/******** PROPORTIONAL SHARE SECTION ****************/
+
+  void SCoopTask::setShare(uint16_t share)
+  { if (share < 1) share = 1;
+    if (share > 1000) share = 1000;
+    this->share = share; stride = SCoopSTRIDEONE / share; }
+
+#if SCoopTIMEREPORT > 0
+  uint16_t SCoopTask::reservedShare()
+  { register uint32_t total = 0;
+    for (register SCoopEvent* ptr = SCoopFirstTaskItem; ptr; ptr = ptr->pNext)
+      if ((ptr->state & (SCoopRUNNABLE | SCoopPAUSED | SCoopKILLING)) == SCoopRUNNABLE)
+         total += reinterpret_cast<SCoopTask*>(ptr)->share;
+    if (total == 0) return 0;
+    return ((uint32_t)share * 1000) / total; }
+
+
+  uint16_t SCoopTask::measuredShare()
+  { register uint32_t total = 0;
+    for (register SCoopEvent* ptr = SCoopFirstTaskItem; ptr; ptr = ptr->pNext)
+      total += reinterpret_cast<SCoopTask*>(ptr)->spentMicros >> 10;   // total of the tasks fits in 32 bits
+    if (total == 0) return 0;
+    return (uint16_t)(((spentMicros >> 10) * 1000) / total); }
+#endif
+#endif
+
+#if SCoopEDF > 0
+/******** PERIODIC TASKS SECTION ****************/
+
+  static uint16_t SCoopEDFLoad(uint32_t cost, SCDelay_t deadline) // micros / millis gives 1/1000
+  { register uint32_t load = (cost + deadline - 1) / deadline;
+    return (load > 0xFFFF) ? 0xFFFF : load; }
+
+
+  bool SCoopTask::setPeriod(SCDelay_t period, SCDelay_t deadline, uint32_t cost)
+  { if (period < 1) return false;
+    if ((deadline < 1) || (deadline > period)) deadline = period;
+    if (cost < costMicros) cost = costMicros;         // keep what was already measured
+    register uint16_t load = SCoopEDFLoad(cost, deadline);
+    if (SCINM.edfLoad - utilization + load > SCoopEDFCAPACITY) return false; // admission control
+    if (!periodMillis) SCINM.edfTasks++;
+    SCINM.edfLoad += load - utilization; utilization = load;
+    costMicros = cost; periodMillis = period; deadlineMillis = deadline;
+    releaseMillis = SCoopDelayMillis();                // first loop() released now
+    if ((SCDelay_t)(releaseMillis - SCINM.edfNext) < 0) SCINM.edfNext = releaseMillis;
+    return true; }
+
+
+  void SCoopTask::clearPeriod()
+  { if (!periodMillis) return;
+    SCINM.edfLoad -= utilization; SCINM.edfTasks--;
+    utilization = 0; periodMillis = 0; }
+
+
+  void SCoopTask::endJob()
+  { register uint32_t spent = SCoopTicksToMicros(jobTicks + (micros_t)(SCoopTicks() - prevMicros));
+    if (spent > costMicros) {                         // measured utilization replaces the given one
+       register uint16_t load = SCoopEDFLoad(spent, deadlineMillis);
+       register bool overloaded = SCINM.edfOverloaded();
+       SCINM.edfLoad += load - utilization; utilization = load; costMicros = spent;
+       if (!overloaded && SCINM.edfOverloaded()) SCINM.edfOverloads++; }
+    register SCDelay_t now = SCoopDelayMillis();
+    if ((SCDelay_t)(now - releaseMillis) > deadlineMillis) deadlineMisses++;
+    releaseMillis += periodMillis;
+    while ((SCDelay_t)(now - releaseMillis) >= periodMillis) { // more than a period late : skip the releases lost
+       releaseMillis += periodMillis; deadlineMisses++; }
+    timer.set(releaseMillis - now);                   // sleep until next release. the scheduler doesnt launch us before
+    if ((SCDelay_t)(releaseMillis - SCINM.edfNext) < 0) SCINM.edfNext = releaseMillis;
+    state = SCoopWAITING;
+    do yield(0); while (timer);                       // always give a chance to an earlier deadline
+    jobTicks = 0;
+    state = SCoopRUNNING; }
+#endif
+
+
 /******** SLEEP SECTION ****************/
 
    
@@ -711,6 +995,34 @@ void SCoopTask::kill()
   };
 
 
+#if SCoopSHAREDSTACK > 0
+/********* SHARED STACK *******/
+
+SCoopSharedStack::SCoopSharedStack(SCoopStack_t* stack, ptrInt size)
+{ bottom = (uint8_t*)stack;
+  top = (uint8_t*)stack + ((size-sizeof(SCoopStack_t))   // same as a task stack
+#if defined(SCoop_ARM) && (SCoop_ARM == 1)
+  & ~7
+#elif defined(SCoop_HOST)
+  & ~15
+#endif
+  );
+  owner = NULL; overflows = 0; swaps = 0;
+  SCoopMemFill(bottom, top, 0x55); }
+
+
+bool SCoopSharedStack::evict()                 // called from the main stack only
+{ register SCoopTask* task = owner;
+  if (task == NULL) return true;
+  register ptrInt used = top - task->pStack + 1; // from the saved stack pointer to the top, included
+  if (used > task->saveSize) { overflows++; return false; } // the owner keeps the stack until it yields with less
+  memcpy(task->saveAddr, task->pStack, used);
+  if (used > task->savePeak) task->savePeak = used;
+  owner = NULL;
+  return true; }
+#endif
+
+
 /********* SCoop METHODS *******/
   
 SCoop::SCoop()        // constructor
@@ -723,6 +1035,22 @@ SCoop::SCoop()        // constructor
 #if SCoopTIMEREPORT > 0                          // verifiy if we want to measure timing  
 	cycleMicros = 0; maxCycleMicros = 0; 
 #endif	
+#if SCoopEDF > 0
+    edfLoad = 0; edfTasks = 0; edfNext = 0; edfOverloads = 0;
+#endif
+#if SCoopSTRIDE > 0
+    stridePass = 0;
+#endif
+#if SCoopTIMERSLACK > 0
+    timerBatch = false; timerBatchNext = false; timerWakeups = 0;
+#endif
+#if SCoopPREEMPT > 0
+    preemptions = 0;
+#endif
+#if SCoopVIRTUALCLOCK > 0
+    virtualCostMicros = 10;                      // close to a yield() on AVR 16mhz
+    mainTimer = NULL; virtualJumpLoop = true;
+#endif
     Current = NULL; 
 	Task    = NULL; 
 	Atomic  = 1; };                               // ensure yield is not activated
@@ -741,7 +1069,8 @@ SCoop::SCoop()        // constructor
     
 	
     void SCoop::start()                           // start all objects in the list
-  { targetCycleMicros = quantumMicros;            // initialization
+  { SCoopTicksInit();                             // enable the cycle counter if used
+    targetCycleMicros = quantumMicros;            // initialization
 #if SCoopYIELDCYCLE == 0
     quantumMicrosReal = quantumMicros / SCoopNumberTask;  // divide time in slice, as we come back here at each task switch...
 #endif
@@ -756,6 +1085,9 @@ SCoop::SCoop()        // constructor
 	SCp(", target cycle time = ");SCpln(targetCycleMicros); // this is calculated by the task::start()
 #endif
 	SCINM.Atomic=0;                          // ready for switchiching task with "yield"
+#if (SCoopPREEMPT > 0) && defined(TIMSK0) && defined(OCIE0B)
+    OCR0B = 0x80; TIMSK0 |= (1 << OCIE0B);        // preemption checked in the middle of each timer0 period
+#endif
    };
    
 
@@ -768,28 +1100,51 @@ SCoop::SCoop()        // constructor
   void SCoop::yield()                          // can be called from where ever in order to Force the switch to next task
   { if (Task) Task->yield();                   // we ve been called from a task context lets yield from there
     else {
+	  SCoopTimeRefresh();                      // one clock reading for all the timers and tasks of this cycle
 	  if (Atomic) return;                      // self explaining
+	  SCoopVirtualCharge();
+#if SCoopDEFERSIZE > 0
+	  SCoopATOMIC { SCoopDeferRun(); }         // calls queued by ISR first, in order
+#endif
+#if (SCoopI2CQUEUE > 0) && (SCoopI2CSIM > 0)
+	  SCoopI2C.interrupt();                    // the simulated bus progresses here
+#endif
       
+#if SCoopTIMERSLACK > 0
+      timerBatch = timerBatchNext; timerBatchNext = false;
+#endif
       register SCoopEvent* temp = SCoopFirstItem;
       while (temp != SCoopFirstTaskItem) { temp->launch(); temp = temp->pNext; }  // launch all events
+#if SCoopEDF > 0
+      if (edfLaunch()) return;                 // a periodic task was ready, the others will wait next yield()
+#endif
+#if SCoopSTRIDE > 0
+      strideLaunch(); return;                  // one task chosen by its share, then back in the main loop
+#endif
 	  
 	  register micros_t time;
 	  if (Current == NULL) {                   // a cycle is completed
+#if SCoopVIRTUALCLOCK > 0
+	     virtualJump();                        // nothing to do until the next deadline ? then go there directly
+#endif
 	     temp = SCoopFirstTaskItem;
 		 if (temp == NULL) return;             // no tasks in the list !
 		    	     
 		 // check overall target cycle time before launching first task
 	     
 #if SCoopTIMEREPORT > 0                         // verifiy if we want to measure timing , then calculate average cycle time 
-	     time = SCoopMicros() - reinterpret_cast<SCoopTask*>(temp)->prevMicros; // mesure whole cycle length based on first task information
+	     time = SCoopTicksToMicros(SCoopTicks() - reinterpret_cast<SCoopTask*>(temp)->prevMicros); // mesure whole cycle length based on first task information
 		 if (quantumMicros) {                   // check if we are supposed to spend some time in the main loop or not
              if (time < targetCycleMicros) return; }   // back in main loop() until we reach the expected target cycle time
          Current = temp;                        // we can launch this first task
          if (time > maxCycleMicros) maxCycleMicros = time; 
 		 cycleMicros += (time - (cycleMicros>> SCoopTIMEREPORT));
+#if SCoopADAPTIVEQUANTUM > 0
+		 adaptQuantum();
+#endif
 #else
 		 if (quantumMicros) {                   // check if we are supposed to spend some time in the main loop or not
-     	     time = SCoopMicros() - reinterpret_cast<SCoopTask*>(temp)->prevMicros; // mesure whole cycle length based on first task information
+     	     time = SCoopTicksToMicros(SCoopTicks() - reinterpret_cast<SCoopTask*>(temp)->prevMicros); // mesure whole cycle length based on first task information
              if (time < targetCycleMicros) return; }   // back in main loop() until we reach the expected target cycle time
          Current = temp;                        // we can launch this first task
 #endif
@@ -797,14 +1152,17 @@ SCoop::SCoop()        // constructor
 		else { // lets check intertask timing before launching the next 
 #if SCoopYIELDCYCLE == 0
      		if (quantumMicrosReal) {              // check if we should spend quite some time in the main loop between 2 tasks
-		       time = SCoopMicros() 
-			        - reinterpret_cast<SCoopTask*>(Current)->prevMicros // give the time since last task executed
+		       time = SCoopTicksToMicros(SCoopTicks() 
+			        - reinterpret_cast<SCoopTask*>(Current)->prevMicros) // give the time since last task executed
 				    - reinterpret_cast<SCoopTask*>(Current)->quantumMicros; // mesure whole cycle length based on first task information
            if (time < quantumMicrosReal) return;   // back in main loop() until we reach the expected target cycle time           
 			}
 #endif			
 		};
 	  do { temp = Current; 
+#if SCoopEDF > 0
+	     if (!reinterpret_cast<SCoopTask*>(temp)->periodMillis)
+#endif
 	     temp->launch();                     // now launch tasks from the list, and may be all in a single launch()
 		 Current = temp->pNext;   
 #if SCoopANDROIDMODE >= 2                    // check if we autorize the killme
@@ -816,11 +1174,97 @@ SCoop::SCoop()        // constructor
 #if SCoopYIELDCYCLE == 0	                   // back to main task if we are not in yield cycle mode
          return; 
 #endif	                                       // otherwise we just go back into the main loop      
+#if SCoopEDF > 0
+         if (edfPending()) return;           // a periodic task may be ready : give it the priority at next yield()
+#endif
 	    } while (Current);
 	} 
 }
 
   
+#if SCoopEDF > 0
+  bool SCoop::edfLaunch()
+  { if (!edfTasks) return false;
+    register SCDelay_t now = SCoopDelayMillis();
+    register SCoopTask* best = NULL;
+    register SCDelay_t deadline = 0;
+    edfNext = now + 1000;                      // rescan at least every second
+    register SCoopEvent* ptr = SCoopFirstTaskItem;
+    while (ptr) {
+      register SCoopTask* task = reinterpret_cast<SCoopTask*>(ptr);
+      if ((task->periodMillis) &&
+         ((ptr->state & (SCoopRUNNABLE | SCoopPAUSED | SCoopKILLING)) == SCoopRUNNABLE)) {
+         register SCDelay_t time = task->timer.get();  // waiting for its release, or sleeping inside its loop()
+         if (time) { if (time < (SCDelay_t)(edfNext - now)) edfNext = now + time; }
+         else {
+            register SCDelay_t taskDeadline = task->releaseMillis + task->deadlineMillis;
+            if ((best == NULL) || ((SCDelay_t)(taskDeadline - deadline) < 0)) {
+               best = task; deadline = taskDeadline; } } }
+      ptr = ptr->pNext; }
+    if (best == NULL) return false;
+    edfNext = now;                             // other periodic tasks may also be ready
+    best->launch();
+    return true; }
+#endif
+
+
+#if SCoopSTRIDE > 0
+  void SCoop::strideRun(SCoopTask* task)
+  { task->launch();
+#if SCoopANDROIDMODE >= 2
+    if ((task->state & SCoopKILLING) && (task->itemType == SCoopDynamicTask)) delete task;
+#endif
+  }
+
+
+  // a task which was not runnable gets no credit for that time : its pass is brought to the current one.
+  // the sleeping tasks are launched at each call, only to check their timer or variable, as in the cycle
+  void SCoop::strideLaunch()
+  { register SCoopTask* best = NULL;
+    register bool halve = false;
+    register SCoopEvent* ptr = SCoopFirstTaskItem;
+    while (ptr) {
+      register SCoopTask* task = reinterpret_cast<SCoopTask*>(ptr);
+      ptr = ptr->pNext;                          // before the task can be deleted
+      if ((int32_t)(task->pass - stridePass) < 0) task->pass = stridePass;
+#if SCoopTIMEREPORT > 0
+      if (task->spentMicros & 0x40000000) halve = true;
+#endif
+#if SCoopEDF > 0
+      if (task->periodMillis) continue;          // launched by edfLaunch() only
+#endif
+      if (((task->state & (SCoopRUNNABLE | SCoopPAUSED | SCoopKILLING)) != SCoopRUNNABLE) // new, paused or killed
+         || ((task->state & (SCoopRUNNING | SCoopWAITING)) == SCoopWAITING)) strideRun(task); // sleeping
+      else if ((best == NULL) || ((int32_t)(task->pass - best->pass) < 0)) best = task; }
+#if SCoopTIMEREPORT > 0
+    if (halve)                                   // keeps the ratios, and the recent time counts more
+       for (ptr = SCoopFirstTaskItem; ptr; ptr = ptr->pNext) reinterpret_cast<SCoopTask*>(ptr)->spentMicros >>= 1;
+#endif
+    if (best) { stridePass = best->pass; strideRun(best); } }
+#endif
+
+
+#if SCoopADAPTIVEQUANTUM > 0
+  // the sum of the shares is targetCycleMicros minus the main loop quantum, so bringing each task
+  // back to its share keeps both the cycle time and the main loop time close to what start() asked for.
+  // a light task which yields before its quantum just gives its time back to the main loop.
+  void SCoop::adaptQuantum()
+  { register SCoopEvent* item = SCoopFirstTaskItem;
+    while (item) {
+      register SCoopTask* task = reinterpret_cast<SCoopTask*>(item);
+      if ((task->shareMicros) &&                 // quantum 0 means always switch : nothing to adjust
+         ((item->state & (SCoopRUNNABLE | SCoopPAUSED)) == SCoopRUNNABLE)) {
+         register micros_t quantum = task->quantumMicros
+                + ((task->shareMicros - (micros_t)SCoopTicksToMicros(task->cycleTicks)) >> SCoopADAPTIVEQUANTUM);
+         if (quantum < task->minQuantumMicros) quantum = task->minQuantumMicros;
+         if (quantum > task->maxQuantumMicros) quantum = task->maxQuantumMicros;
+         task->quantumMicros = quantum; }
+      task->cycleTicks = 0;
+      item = item->pNext; }
+  }
+#endif
+
+  
   void SCoop::cycle() {                         // execute a complete cycle across all tasks & events
 #if SCoopTRACE > 1
      SCpln("start scheduler cycle()");
@@ -832,13 +1276,50 @@ SCoop::SCoop()        // constructor
   
   void SCoop::sleep(SCDelay_t time)                 
 {  SCoopDelay SCoopSleepTimer;
-   SCoopSleepTimer = time; while (SCoopSleepTimer) SCINM.yield(); }
+   SCoopSleepTimer = time; 
+#if SCoopVIRTUALCLOCK > 0
+   if (Task) { while (SCoopSleepTimer) SCINM.yield(); return; }
+   mainTimer = &SCoopSleepTimer;                // let the scheduler know until when the main loop has nothing to do
+   while (SCoopSleepTimer) SCINM.yield(); 
+   mainTimer = NULL; 
+#else
+   while (SCoopSleepTimer) SCINM.yield(); 
+#endif
+}
 
    
-   void SCoop::delay(uint32_t ms) {
-  uint32_t end = millis() + ms;
-  while (millis() < end)	yield();
-}
+   void SCoop::delay(uint32_t ms)               // rely on sleep(), so that it follows the same time source
+{ sleep((SCDelay_t)ms); }
+
+
+#if SCoopVIRTUALCLOCK > 0
+#define SCoopNoDeadline 0x7FFFFFFFL
+
+  void SCoop::virtualJump()                     // only jump if each item is waiting for time, and the main loop is sleeping
+{ if (SCoopMillisSource != SCoopVirtualMillis) return; // or only yielding
+  if ((mainTimer == NULL) && !virtualJumpLoop) return;
+#if SCoopDEFERSIZE > 0
+  if (SCoopDeferCount()) return;
+#endif
+  register SCDelay_t next = (mainTimer) ? mainTimer->get() : SCoopNoDeadline;
+  register SCoopEvent* ptr = SCoopFirstItem;
+  while (ptr) {
+    if (!(ptr->state & SCoopPAUSED)) {
+       if (ptr->state & SCoopTRIGGER) return;    // an event is waiting to be launched
+       if (ptr->itemType == SCoopTimerType) {
+          register SCDelay_t time = reinterpret_cast<SCoopTimerBase*>(ptr)->getTimeToRun();
+          if ((time >= 0) && (time < next)) next = time; }
+       else if (ptr->itemType == SCoopStageType) {
+          register SCDelay_t time = reinterpret_cast<SCoopStage*>(ptr)->getTimeToRun();
+          if (time == 0) return;                  // this stage can run now
+          if ((time > 0) && (time < next)) next = time; }
+       else if ((ptr->itemType == SCoopTaskType) || (ptr->itemType == SCoopDynamicTask)) {
+          if ((ptr->state & (SCoopRUNNING | SCoopWAITING)) != SCoopWAITING) return; // this task has something to do
+          register SCDelay_t time = reinterpret_cast<SCoopTask*>(ptr)->timer.get();
+          if ((time > 0) && (time < next)) next = time; } }
+    ptr = ptr->pNext; }
+  if ((next > 0) && (next != SCoopNoDeadline)) { SCoopVirtualAdvanceMillis(next); SCoopTimeRefresh(); } } // nothing to wait for : no jump
+#endif
 
 
 #if SCoopANDROIDMODE >= 1
@@ -966,8 +1447,749 @@ uint16_t SCoopFifo::flushNonAtomic() {             // empty the fifo
      ptrOut = ptrMin;
   return (ptrMax-ptrMin); }
 
-<<<<<<< HEAD
-  
-=======
+
+uint16_t SCoopFifo::room()                         // one item always stays free, see put()
+{ return (ptrMax - ptrMin) / itemSize - 1 - count() / itemSize; }
+
+
+uint16_t SCoopFifo::readSpan(void** items)         // contiguous items from ptrOut up to ptrIn or the end of the buffer
+{ register uint8_t* In;
+  register uint8_t* Out;
+  AVR_ATOMIC { In = ptrIn; Out = ptrOut; }
+  *items = Out;
+  if (In < Out) In = ptrMax;
+  return (In - Out) / itemSize; }
+
+
+void SCoopFifo::readDone(uint16_t number)          // a span never crosses ptrMax, so only one wrap to check
+{ register uint8_t* Out = ptrOut + number * itemSize;
+  if (Out >= ptrMax) Out = ptrMin;
+  AVR_ATOMIC { ptrOut = Out; } }
+
+
+uint16_t SCoopFifo::writeSpan(void** items)        // one item stays free, as in put(), to distinguish full from empty
+{ register uint8_t* In;
+  register uint8_t* Out;
+  AVR_ATOMIC { In = ptrIn; Out = ptrOut; }
+  *items = In;
+  if (Out > In) Out -= itemSize;
+  else if (Out == ptrMin) Out = ptrMax - itemSize;
+  else Out = ptrMax;
+  return (Out - In) / itemSize; }
+
+
+void SCoopFifo::writeDone(uint16_t number)
+{ register uint8_t* In = ptrIn + number * itemSize;
+  if (In >= ptrMax) In = ptrMin;
+  AVR_ATOMIC { ptrIn = In; } }
+
+
+/*************** BROADCAST *****************/
+
+SCoopBroadcast::SCoopBroadcast(void * buffer, const uint8_t itemSize, const uint16_t itemNumber)
+   { this->itemSize = itemSize; this->itemNumber = itemNumber;
+     ptrMin = (uint8_t*)buffer;
+     ptrIn  = (uint8_t*)buffer;
+     ptrMax = (uint8_t*)buffer + (itemNumber * itemSize);
+     seq = 0; }
+
+
+void* SCoopBroadcast::writeItem()
+{ return ptrIn; }
+
+
+void SCoopBroadcast::publish()                      // the slot after ptrIn is now the oldest one, it will be written next
+{ register uint8_t* In = ptrIn + itemSize;
+  if (In >= ptrMax) In = ptrMin;
+  AVR_ATOMIC { ptrIn = In; seq++; } }
+
+
+void SCoopBroadcast::put(const void* var)
+{ memcpy(ptrIn, var, itemSize);
+  publish(); }
+
+
+uint16_t SCoopBroadcast::published()
+{ register uint16_t temp;
+  AVR_ATOMIC { temp = seq; }
+  return temp; }
+
+
+SCoopSubscriber::SCoopSubscriber(SCoopBroadcast& channel)
+{ this->channel = &channel;
+  seq = channel.seq; lost = 0; }
+
+
+uint16_t SCoopSubscriber::sync(const void** item) // the next item is found back from the writer position
+{ register uint16_t In;
+  register uint8_t* ptr;
+  do { AVR_ATOMIC { ptr = channel->ptrIn; In = channel->seq; } } // read again if an isr published in between (ARM)
+  while (ptr != channel->ptrIn);
+  register uint16_t n = In - seq;
+  if (n >= channel->itemNumber) {                   // too slow : restart from the oldest item still intact
+     lost += n - (channel->itemNumber - 1);
+     n = channel->itemNumber - 1; seq = In - n; }
+  ptr -= n * channel->itemSize;
+  if (ptr < channel->ptrMin) ptr += channel->ptrMax - channel->ptrMin;
+  *item = ptr;
+  return n; }
+
+
+uint16_t SCoopSubscriber::available()
+{ const void* item;
+  return sync(&item); }
+
+
+const void* SCoopSubscriber::peek()
+{ const void* item;
+  if (sync(&item) == 0) return NULL;
+  return item; }
+
+
+bool SCoopSubscriber::next()                        // the item peeked is intact if the writer did not start its slot again
+{ register bool intact = ((uint16_t)(channel->published() - seq) < channel->itemNumber);
+  seq++;
+  if (!intact) lost++;
+  return intact; }
+
+
+bool SCoopSubscriber::get(void* var)
+{ register const void* item = peek();
+  if (item == NULL) return false;
+  memcpy(var, item, channel->itemSize);
+  return next(); }
+
+
+/*************** SCoopSTAGE *****************/
+
+SCoopStage::SCoopStage(SCoopFifo* input, SCoopFifo* output, SCDelay_t period, SCoopFunc_t func) : SCoopEvent()
+{ this->input = input; this->output = output;
+  itemsIn = 0; itemsOut = 0; runs = 0; blocked = 0;
+  timer.setReload(period); timer.reset();
+  itemType = SCoopStageType;
+  init(func); }
+
+
+bool SCoopStage::get(void* item)
+{ if (input && input->get(item)) { itemsIn++; return true; }
+  return false; }
+
+
+bool SCoopStage::put(void* item)
+{ if (output && output->put(item)) { itemsOut++; return true; }
+  return false; }
+
+
+bool SCoopStage::ready()
+{ if (input && (*input == 0)) return false;
+  if (output && (output->room() == 0)) return false;
+  return true; }
+
+
+void SCoopStage::start()
+{ SCoopEvent::start();
+  timer.initReload(); }
+
+
+SCDelay_t SCoopStage::getTimeToRun()
+{ if (!ready()) return -1;
+  if (timer.getReload() == 0) return 0;
+  return timer.get(); }
+
+
+bool SCoopStage::launch()
+{ if (state & SCoopPAUSED) return false;
+  if (timer.getReload() && !timer.elapsed()) return false;
+  if (input && (*input == 0)) return false;
+  if (output && (output->room() == 0)) { blocked++; return false; } // backpressure : wait for the next stage
+  if (timer.getReload()) {
+     timer.reload();
+     if (timer.elapsed()) timer.initReload(); } // late because of backpressure : no burst to catch up
+  state |= SCoopTRIGGER;
+  register bool launched = SCoopEvent::launch();
+  if (launched) runs++;
+  return launched; }
+
+
+/*************** DSP STAGES ON FIFO *****************/
+
+#if defined(__ARM_FEATURE_DSP)                     // cortex M4 : saturation and dual 16 bits multiply accumulate
+static inline int16_t SCoopSat16(int32_t x)
+{ asm ("ssat %0, #16, %1" : "=r" (x) : "r" (x)); return x; }
+#else
+static inline int16_t SCoopSat16(int32_t x)
+{ return (x > 32767) ? 32767 : ((x < -32768) ? -32768 : x); }
+#endif
+
+
+static uint16_t SCoopSqrt32(uint32_t x)            // integer square root, bit by bit
+{ register uint32_t root = 0;
+  register uint32_t bit = 1UL << 30;
+  while (bit > x) bit >>= 2;
+  while (bit) {
+     if (x >= root + bit) { x -= root + bit; root = (root >> 1) + bit; }
+     else root >>= 1;
+     bit >>= 2; }
+  return root; }
+
+
+uint16_t SCoopDSPStage::run(SCoopFifo& in, SCoopFifo* out, uint16_t max)
+{ register uint16_t done = 0;
+  while (done < max) {
+     void* src; void* dst = NULL;
+     register uint16_t n = in.readSpan(&src);
+     if (n == 0) break;
+     if (n > max - done) n = max - done;
+     if (out) {                                    // results are never more than the input samples
+        register uint16_t room = out->writeSpan(&dst);
+        if (room == 0) break;
+        if (n > room) n = room; }
+     register uint16_t results = process((const int16_t*)src, (int16_t*)dst, n);
+     in.readDone(n);
+     if (out) out->writeDone(results);
+     done += n; }
+  samples += done;
+  return done; }
+
+
+uint16_t SCoopEMA::process(const int16_t* in, int16_t* out, uint16_t number)
+{ register int32_t a = acc;
+  register uint8_t s = shift;
+  for (register uint16_t i = 0; i < number; i++) {
+     a += in[i] - (a >> s);
+     if (out) out[i] = SCoopSat16(a >> s); }
+  acc = a; value = SCoopSat16(a >> s);
+  return out ? number : 0; }
+
+
+SCoopMovingAverage::SCoopMovingAverage(int16_t* history, uint8_t shift)
+{ this->history = history; this->shift = shift; index = 0; sum = 0;
+  for (uint16_t i = 0; i < (1U << shift); i++) history[i] = 0; }
+
+
+uint16_t SCoopMovingAverage::process(const int16_t* in, int16_t* out, uint16_t number)
+{ register uint16_t mask = (1U << shift) - 1;
+  for (register uint16_t i = 0; i < number; i++) {
+     sum += in[i] - history[index];
+     history[index] = in[i]; index = (index + 1) & mask;
+     if (out) out[i] = SCoopSat16(sum >> shift); }
+  value = SCoopSat16(sum >> shift);
+  return out ? number : 0; }
+
+
+SCoopMedian::SCoopMedian(int16_t* buffer, uint8_t length)
+{ this->length = length; history = buffer; sorted = buffer + length; index = 0;
+  for (uint8_t i = 0; i < length; i++) { history[i] = 0; sorted[i] = 0; } }
+
+
+uint16_t SCoopMedian::process(const int16_t* in, int16_t* out, uint16_t number)
+{ for (register uint16_t i = 0; i < number; i++) {
+     register int16_t old = history[index];
+     register int16_t x = in[i];
+     history[index] = x; if (++index >= length) index = 0;
+     register uint8_t j = 0;
+     while (sorted[j] != old) j++;                 // remove the oldest sample from the sorted copy
+     while ((j > 0) && (sorted[j - 1] > x)) { sorted[j] = sorted[j - 1]; j--; } // and insert the new one in its place
+     while ((j < length - 1) && (sorted[j + 1] < x)) { sorted[j] = sorted[j + 1]; j++; }
+     sorted[j] = x;
+     if (out) out[i] = sorted[length >> 1]; }
+  value = sorted[length >> 1];
+  return out ? number : 0; }
+
+
+uint16_t SCoopDecimator::process(const int16_t* in, int16_t* out, uint16_t number)
+{ register uint16_t results = 0;
+  for (register uint16_t i = 0; i < number; i++) {
+     sum += in[i];
+     if (++count >= factor) {
+        value = SCoopSat16(sum / factor);
+        if (out) out[results++] = value;
+        sum = 0; count = 0; } }
+  return results; }
+
+
+SCoopWindow::SCoopWindow(uint16_t length)
+{ this->length = length; count = 0; windows = 0; sum = 0; sumSquares = 0;
+  minimum = maximum = mean = 0; rms = 0; curMin = 32767; curMax = -32768; }
+
+
+uint16_t SCoopWindow::process(const int16_t* in, int16_t* out, uint16_t number)
+{ register uint16_t results = 0;
+  while (number) {
+     register uint16_t n = length - count;
+     if (n > number) n = number;
+     register int32_t s = 0;
+     register int16_t lo = curMin, hi = curMax;
+     register uint16_t i = 0;
+#if defined(__ARM_FEATURE_DSP)
+     uint32_t sqLow = (uint32_t)sumSquares, sqHigh = sumSquares >> 32;
+     for (; i + 1 < n; i += 2) {                   // two squares per smlald
+        uint32_t pair; memcpy(&pair, in + i, 4);
+        asm ("smlald %0, %1, %2, %2" : "+r" (sqLow), "+r" (sqHigh) : "r" (pair));
+        s += in[i] + in[i + 1]; }
+     sumSquares = ((uint64_t)sqHigh << 32) | sqLow;
+#endif
+     for (; i < n; i++) { s += in[i]; sumSquares += (int32_t)in[i] * in[i]; } // vectorized by the compiler on a host
+     for (i = 0; i < n; i++) {
+        if (in[i] < lo) lo = in[i];
+        if (in[i] > hi) hi = in[i]; }
+     sum += s; curMin = lo; curMax = hi;
+     in += n; number -= n; count += n;
+     if (count >= length) {                        // window complete : latch the results
+        minimum = curMin; maximum = curMax; mean = sum / (int32_t)length;
+        rms = SCoopSqrt32(sumSquares / length); value = rms;
+        if (out) out[results++] = rms;
+        windows++; count = 0; sum = 0; sumSquares = 0; curMin = 32767; curMax = -32768; } }
+  return results; }
+
   
->>>>>>> upstream/master
+
+
+/*************** SCoopLOG METHODS ******************/
+
+#if defined(SCoop_AVR)
+#define SCoopLogReadFlash(p) pgm_read_byte(p)
+#else
+#define SCoopLogReadFlash(p) (*(p))
+#endif
+
+#define SCoopLogMaxArgs 4
+
+SCoopLog::SCoopLog(void * buffer, const uint16_t size)
+   { this->buffer = (uint8_t*)buffer;
+     this->size = size;
+     in = 0; out = 0; lost = 0; }
+
+
+uint16_t SCoopLog::count()
+{ register int16_t temp;
+  AVR_ATOMIC { temp = in - out; }
+  return (temp < 0 ? temp + size : temp); }
+
+
+void SCoopLog::putByte(uint16_t& index, uint8_t value) // index is a local copy of "in", published by putArgs() once
+{ buffer[index] = value;                                // the record is complete, so the reader never sees a partial one
+  if (++index >= size) index = 0; }
+
+uint8_t SCoopLog::getByte(uint16_t& index)
+{ register uint8_t value = buffer[index];
+  if (++index >= size) index = 0;
+  return value; }
+
+
+bool SCoopLog::putArgs(const char* fmt, uint8_t n, const uint32_t* args)
+{ register uint8_t len = sizeof(fmt) + 1 + (n << 2);
+  register bool ok = false;
+  SCoopATOMIC {                                      // no other task can put() between the room check and the publication
+     uint16_t index, tail;
+     AVR_ATOMIC { index = in; tail = out; }
+     register int16_t used = index - tail;
+     if (used < 0) used += size;
+     if (size - 1 - used < len) lost++;
+     else {
+        register ptrInt id = (ptrInt)fmt;
+        for (uint8_t i = 0; i < sizeof(fmt); i++) { putByte(index, id); id >>= 8; }
+        putByte(index, n);
+        while (n--) { register uint32_t val = *args++;
+           putByte(index, val); putByte(index, val >> 8); putByte(index, val >> 16); putByte(index, val >> 24); }
+        AVR_ATOMIC { in = index; }
+        ok = true; } }
+  return ok; }
+
+bool SCoopLog::put(const char* fmt)
+{ return putArgs(fmt, 0, NULL); }
+
+bool SCoopLog::put(const char* fmt, uint32_t a)
+{ return putArgs(fmt, 1, &a); }
+
+bool SCoopLog::put(const char* fmt, uint32_t a, uint32_t b)
+{ uint32_t args[2] = { a, b }; return putArgs(fmt, 2, args); }
+
+bool SCoopLog::put(const char* fmt, uint32_t a, uint32_t b, uint32_t c)
+{ uint32_t args[3] = { a, b, c }; return putArgs(fmt, 3, args); }
+
+bool SCoopLog::put(const char* fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{ uint32_t args[4] = { a, b, c, d }; return putArgs(fmt, 4, args); }
+
+
+bool SCoopLog::getRecord(const char* * fmt, uint8_t* n, uint32_t* args)
+{ uint16_t index;
+  register bool empty;
+  AVR_ATOMIC { index = out; empty = (in == index); }
+  if (empty) return false;
+  ptrInt id = 0;
+  for (uint8_t i = 0; i < sizeof(*fmt); i++) id |= (ptrInt)getByte(index) << (i << 3);
+  *fmt = (const char*)id;
+  *n = getByte(index);
+  for (uint8_t i = 0; i < *n; i++) {
+     register uint32_t val = getByte(index); val |= (uint32_t)getByte(index) << 8;
+     val |= (uint32_t)getByte(index) << 16;  val |= (uint32_t)getByte(index) << 24;
+     args[i] = val; }
+  AVR_ATOMIC { out = index; }                         // the room is given back to put() at once
+  return true; }
+
+
+bool SCoopLog::print(Print& out)
+{ const char* fmt; uint8_t n; uint32_t args[SCoopLogMaxArgs];
+  if (!getRecord(&fmt, &n, args)) return false;
+  register uint8_t arg = 0;
+  register char c;
+  while ((c = SCoopLogReadFlash(fmt++))) {
+     if (c != '%') { out.print(c); continue; }
+     while ((c = SCoopLogReadFlash(fmt++)) == 'l') ;  // all arguments are 32 bits anyway
+     if (c == 0) break;
+     if (c == '%') { out.print(c); continue; }
+     register uint32_t val = (arg < n) ? args[arg++] : 0;
+     switch (c) {
+       case 'd' :
+       case 'i' : out.print((long)(int32_t)val); break;
+       case 'u' : out.print((unsigned long)val); break;
+       case 'x' :
+       case 'X' : out.print((unsigned long)val, HEX); break;
+       case 'c' : out.print((char)val); break;
+       case 'f' : { union { uint32_t u; float f; } v; v.u = val; out.print(v.f); } break;
+       default  : out.print('%'); out.print(c); }
+    }
+  out.print('\r'); out.print('\n');
+  return true; }
+
+
+bool SCoopLog::write(Print& out)
+{ const char* fmt; uint8_t n; uint32_t args[SCoopLogMaxArgs];
+  if (!getRecord(&fmt, &n, args)) return false;
+  out.write((uint8_t)0xA5);
+  ptrInt id = (ptrInt)fmt;
+  for (uint8_t i = 0; i < sizeof(fmt); i++) { out.write((uint8_t)id); id >>= 8; }
+  out.write(n);
+  for (uint8_t i = 0; i < n; i++) {
+     register uint32_t val = args[i];
+     for (uint8_t j = 0; j < 4; j++) { out.write((uint8_t)val); val >>= 8; } }
+  return true; }
+
+
+/*************** SCoopSTREAM METHODS ******************/
+
+int16_t SCoopStream::room()
+{ register int16_t free = SCoopStreamFree(port);
+  if (free > maxFree) maxFree = free;
+  return (maxFree ? free : -1); }                     // never seen any room : the port doesnt tell
+
+
+int SCoopStream::availableForWrite()
+{ register int16_t free = room();
+  return (free < 0 ? 0 : free); }
+
+
+size_t SCoopStream::write(uint8_t value)
+{ while (room() == 0) SCINM.yield();
+  return port.write(value); }
+
+
+size_t SCoopStream::write(const uint8_t *buffer, size_t size)
+{ register size_t done = 0;
+  while (done < size) {
+     register int16_t free = room();
+     if (free < 0) return done + port.write(buffer + done, size - done);
+     if (free == 0) { SCINM.yield(); continue; }
+     if ((size_t)free > size - done) free = size - done;
+     done += port.write(buffer + done, free); }
+  return done; }
+
+
+bool SCoopStream::tryWrite(uint8_t value)
+{ if (room() == 0) return false;
+  return (port.write(value) == 1); }
+
+
+size_t SCoopStream::tryWrite(const uint8_t *buffer, size_t size)
+{ register int16_t free = room();
+  if (free < 0) return port.write(buffer, size);
+  if ((size_t)free > size) free = size;
+  return (free ? port.write(buffer, free) : 0); }
+
+
+void SCoopStream::flush()
+{ if (room() < 0) { port.flush(); return; }
+  while (room() < maxFree) SCINM.yield(); }
+
+
+int SCoopStream::readWait()
+{ while (!port.available()) SCINM.yield();
+  return port.read(); }
+
+
+/*************** SCoopADC SERVICE ******************/
+
+#if SCoopADCSCAN > 0
+
+SCoopADCScan SCoopADC;
+
+SCoopADCScan::SCoopADCScan()
+{ channels = 0; current = 0; count = 0; sum = 0;
+  overruns = 0; active = false;
+#if defined(SCoop_AVR)
+  busy = false; period = 1; ticks = 0;
+#endif
+}
+
+
+int8_t SCoopADCScan::addChannel(uint8_t pin, SCoopFifo& fifo, uint8_t oversampling)
+{ if (active || (channels >= SCoopADCSCAN)) return -1;
+  if (oversampling > 6) oversampling = 6;
+  channel[channels].pin   = pin;
+  channel[channels].shift = oversampling;
+  channel[channels].fifo  = &fifo;
+  return channels++; }
+
+
+void SCoopADCScan::waitSample(uint8_t index, SCoopADCSample_t* sample)
+{ register SCoopFifo* fifo = channel[index].fifo;
+  while (!fifo->count()) SCINM.yield();
+  fifo->get(sample); }
+
+
+bool SCoopADCScan::conversion(uint16_t value)
+{ sum += value;
+  if (++count < (1 << channel[current].shift)) return false;  // oversampling : same channel again
+  SCoopADCSample_t sample;
+  sample.micros = scanMicros;
+  sample.value  = sum >> channel[current].shift;
+  if (!channel[current].fifo->put(&sample)) overruns++;
+  count = 0; sum = 0;
+  if (++current < channels) return false;
+  current = 0; return true; }
+
+
+#if defined(SCoop_AVR)
+
+void SCoopADCScan::select(uint8_t index)
+{ register uint8_t pin = channel[index].pin;
+#if defined(analogPinToChannel)
+  pin = analogPinToChannel(pin);
+#elif defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+  if (pin >= 54) pin -= 54;
+#else
+  if (pin >= 14) pin -= 14;
+#endif
+#if defined(MUX5)
+  ADCSRB = (ADCSRB & ~(1 << MUX5)) | (((pin >> 3) & 1) << MUX5);
+#endif
+  ADMUX = (1 << REFS0) | (pin & 7); }            // AVcc reference, as analogReference(DEFAULT)
+
+
+void SCoopADCScan::start(SCDelay_t periodMillis)
+{ if (!channels) return;
+  register uint32_t overflows = ((uint32_t)periodMillis * (F_CPU / 1000L)) / 16384L; // timer0 : prescaler 64, 256 counts
+  period = (overflows ? overflows : 1);
+  AVR_ATOMIC {
+     ticks = 0; busy = false; current = 0; count = 0; sum = 0;
+     select(0);
+     ADCSRB = (ADCSRB & ~7) | 4;                  // auto trigger source : timer0 overflow
+     ADCSRA = (1 << ADEN) | (1 << ADATE) | (1 << ADIE) | 7; // prescaler 128 : 125khz at 16mhz
+     active = true; } }
+
+
+void SCoopADCScan::stop()
+{ AVR_ATOMIC { ADCSRA = (1 << ADEN) | 7; active = false; busy = false; } } // back to the analogRead() settings
+
+
+void SCoopADCScan::interrupt()
+{ register uint16_t value = ADC;
+  if (!busy) {                                    // this conversion was started by timer0
+     if (++ticks < period) return;                // not yet the time for a new scan : result ignored
+     ticks = 0; busy = true; scanMicros = micros(); }
+  if (conversion(value)) {                        // scan complete : wait next trigger, mux ready for the first channel
+     busy = false; select(0); return; }
+  select(current);
+  ADCSRA |= (1 << ADSC); }                        // chain the next conversion now
+
+
+ISR(ADC_vect)
+{ SCoopADC.interrupt(); }
+
+#else
+
+static void SCoopADCPoll() { SCoopADC.interrupt(); }
+
+void SCoopADCScan::start(SCDelay_t periodMillis)
+{ if (!channels) return;
+  current = 0; count = 0; sum = 0;
+  timer.init(periodMillis, SCoopADCPoll);
+  timer.start();
+  active = true; }
+
+
+void SCoopADCScan::stop()
+{ timer.pause(); active = false; }
+
+
+void SCoopADCScan::interrupt()                    // the whole scan at once
+{ scanMicros = micros();
+  while (!conversion(analogRead(channel[current].pin))); }
+
+#endif
+
+#endif
+
+
+/*************** SCoopI2C SERVICE ******************/
+
+#if SCoopI2CQUEUE > 0
+#if (SCoopI2CQUEUE & (SCoopI2CQUEUE - 1)) || (SCoopI2CQUEUE > 128)
+#error "SCoopI2CQUEUE must be a power of 2, up to 128"
+#endif
+#if !defined(SCoop_AVR) && (SCoopI2CSIM == 0)
+#error "SCoopI2C drives the AVR TWI only, use SCoopI2CSIM on other platforms"
+#endif
+
+SCoopI2CBus SCoopI2C;
+
+#if defined(SCoop_AVR) && (SCoopI2CSIM == 0)
+#define SCoopTWCR(x) (TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE) | (x))
+#endif
+
+SCoopI2CBus::SCoopI2CBus()
+{ queueIn = 0; queueOut = 0; current = NULL; busy = false; errors = 0;
+#if SCoopI2CSIM > 0
+  clock = 100000;                              // devices is left to the static zero init, models may register before
+#endif
+}
+
+
+bool SCoopI2CBus::submit(SCoopI2CTransfer& transfer)
+{ register bool ok = false;
+  transfer.status = SCoopI2CPENDING;
+  AVR_ATOMIC { ARM_ATOMIC {
+     if ((uint8_t)(queueIn - queueOut) < SCoopI2CQUEUE) {
+        queue[queueIn & (SCoopI2CQUEUE - 1)] = &transfer; queueIn++; ok = true;
+        if (!busy) { busy = true; startCurrent(); } } } }
+  return ok; }
+
+
+uint8_t SCoopI2CBus::wait(SCoopI2CTransfer& transfer)
+{ while (transfer.status == SCoopI2CPENDING) SCINM.yield();
+  return transfer.status; }
+
+
+uint8_t SCoopI2CBus::transfer(SCoopI2CTransfer& transfer)
+{ while (!submit(transfer)) SCINM.yield();
+  return wait(transfer); }
+
+
+uint8_t SCoopI2CBus::write(uint8_t address, const uint8_t* data, uint8_t length)
+{ SCoopI2CTransfer temp;
+  temp.address = address; temp.writeData = data; temp.writeLength = length; temp.readLength = 0;
+  return transfer(temp); }
+
+
+uint8_t SCoopI2CBus::read(uint8_t address, uint8_t reg, uint8_t* data, uint8_t length)
+{ SCoopI2CTransfer temp;
+  temp.address = address; temp.writeData = &reg; temp.writeLength = 1; temp.readData = data; temp.readLength = length;
+  return transfer(temp); }
+
+
+void SCoopI2CBus::finish(uint8_t status)      // called with interrupts off (or from the isr). chain next transfer if any
+{ current->status = status;
+  if (status != SCoopI2CDONE) errors++;
+  queueOut++;
+  if (queueIn != queueOut) startCurrent();
+  else {
+     busy = false; current = NULL;
+#if SCoopI2CSIM == 0
+     TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO); // no interrupt after a stop
+#endif
+  } }
+
+
+#if SCoopI2CSIM == 0
+
+void SCoopI2CBus::begin(uint32_t clock)
+{
+#if defined(SDA) && defined(SCL)
+  digitalWrite(SDA, 1); digitalWrite(SCL, 1);  // internal pull up, as Wire does
+#endif
+  TWSR = 0;                                    // prescaler 1
+  TWBR = ((F_CPU / clock) - 16) / 2;
+  TWCR = (1 << TWEN); }
+
+
+void SCoopI2CBus::startCurrent()                // stop the previous transfer if any, and start this one
+{ current = queue[queueOut & (SCoopI2CQUEUE - 1)];
+  index = 0;
+  SCoopTWCR((1 << TWSTA) | ((TWCR & (1 << TWIE)) ? (1 << TWSTO) : 0)); }
+
+
+void SCoopI2CBus::interrupt()
+{ register SCoopI2CTransfer* t = current;
+  switch (TWSR & 0xF8) {
+  case 0x08 :                                  // start
+  case 0x10 :                                  // repeated start
+     if ((index == 0) && t->writeLength) TWDR = t->address << 1;
+     else { TWDR = (t->address << 1) | 1; index = 0; }              // read phase
+     SCoopTWCR(0); break;
+  case 0x18 :                                  // address + write acked
+  case 0x28 :                                  // data acked
+     if (index < t->writeLength) { TWDR = t->writeData[index++]; SCoopTWCR(0); }
+     else if (t->readLength) { index = 0xFF; SCoopTWCR(1 << TWSTA); } // repeated start for reading
+     else finish(SCoopI2CDONE);
+     break;
+  case 0x40 :                                  // address + read acked
+     SCoopTWCR((t->readLength > 1) ? (1 << TWEA) : 0); break;
+  case 0x50 :                                  // data received, acked
+     t->readData[index++] = TWDR;
+     SCoopTWCR((index < t->readLength - 1) ? (1 << TWEA) : 0); break;
+  case 0x58 :                                  // last data received, nacked
+     t->readData[index] = TWDR;
+     finish(SCoopI2CDONE); break;
+  case 0x20 :                                  // address + write nacked
+  case 0x30 :                                  // data nacked
+  case 0x48 :                                  // address + read nacked
+     finish(SCoopI2CNACK); break;
+  default :                                    // arbitration lost or bus error
+     SCoopTWCR(0);                             // release the bus
+     finish(SCoopI2CERROR); }
+}
+
+
+ISR(TWI_vect)
+{ SCoopI2C.interrupt(); }
+
+#else
+
+SCoopI2CDevice::SCoopI2CDevice(uint8_t address)
+{ this->address = address;
+  next = SCoopI2C.devices; SCoopI2C.devices = this; }
+
+
+void SCoopI2CBus::begin(uint32_t clock)
+{ this->clock = clock; }
+
+
+void SCoopI2CBus::startCurrent()
+{ current = queue[queueOut & (SCoopI2CQUEUE - 1)];
+  startMicros = micros(); }
+
+
+void SCoopI2CBus::interrupt()                   // the transfer happens at once when its time on the bus is over
+{ register SCoopI2CTransfer* t = current;
+  if (!busy || (t == NULL)) return;
+  register uint16_t bits = 9 * (1 + t->writeLength + (t->readLength ? 1 + t->readLength : 0)) + 2;
+  if ((micros() - startMicros) < (bits * 1000000UL) / clock) return;
+  register SCoopI2CDevice* dev = devices;
+  while (dev && (dev->address != t->address)) dev = dev->next;
+  register uint8_t status = SCoopI2CDONE;
+  if (dev == NULL) status = SCoopI2CNACK;
+  else {
+     if (t->writeLength) {
+        dev->start(false);
+        for (uint8_t i = 0; i < t->writeLength; i++)
+            if (!dev->write(t->writeData[i])) { status = SCoopI2CNACK; break; } }
+     if ((status == SCoopI2CDONE) && t->readLength) {
+        dev->start(true);
+        for (uint8_t i = 0; i < t->readLength; i++) t->readData[i] = dev->read(); }
+     dev->stop(); }
+  AVR_ATOMIC { ARM_ATOMIC { finish(status); } } }
+
+#endif
+
+#endif
@@ -36,6 +36,51 @@
 									 
 #define  SCoopOVERLOADYIELD 1        // set to 1 to provides a yield() global function which will overload standard arduino yield()
 
+#define  SCoopADAPTIVEQUANTUM 0      // 1 to 4 : at the end of each cycle, every task quantumMicros is corrected by 1/2^x of the difference
+                                     // between its share (its quantum at start) and the time really spent in it during the cycle,
+                                     // within minQuantumMicros..maxQuantumMicros. 0 = fixed quantum. needs SCoopTIMEREPORT > 0
+
+#define  SCoopEDF           0        // set to 1 to allow periodic tasks (task.setPeriod() in setup) : the ready periodic task with
+                                     // the earliest deadline is always launched first, the other tasks share the remaining time
+#define  SCoopEDFCAPACITY   900      // maximum utilization accepted by setPeriod() for all periodic tasks together, in 1/1000 of the cpu
+
+#define  SCoopSTRIDE        0        // set to 1 for proportional share : each yield() of the main loop launches the task with the lowest
+                                     // time spent divided by its share (task.setShare()), instead of cycling through all the tasks.
+                                     // the cpu time of the tasks is then split as their shares, whatever their number of yield()
+#define  SCoopSTRIDEDEFAULT 10       // share of a task which did not call setShare()
+
+#define  SCoopDEFERSIZE     0        // 0 = no deferred call queue. 2,4,8..128 = number of SCoopDefer(func,arg) calls that an ISR can
+                                     // queue before the next mySCoop.yield() runs them in the main loop, in order
+
+#define  SCoopEVENTCOUNT    0        // set to 1 to allow event.setCounted() : set() calls are counted instead of being merged in one flag
+
+#define  SCoopPREEMPT       0        // AVR only. 1 = the timer0 compare B interrupt (each 1024us) switches a task which is over its
+                                     // quantum without calling yield(), except inside SCoopATOMIC. tasks are then concurrent :
+                                     // protect shared non reentrant code (Serial...) with SCoopATOMIC. the isr frame uses the task stack
+
+#define  SCoopTIMERSLACK    0        // set to 1 to allow timer.setSlack(ms) : such a timer also runs up to "slack" ms before its time
+                                     // when another timer is due, so that close timers are launched together in one pass
+
+#define  SCoopSHAREDSTACK   0        // set to 1 to allow tasks running on a SCoopSharedStack : their used stack is copied to a small
+                                     // save area when another task needs the shared stack, and back before running again
+
+#define  SCoopCACHEDTIME    0        // set to 1 so that SCoopDelay, SCoopDelayus, timers and sleep read the time sampled once by each
+                                     // mySCoop.yield() of the main loop (or by set()) instead of calling millis()/micros() each time.
+                                     // code polling a delay without ever yielding must use getLive() or SCoopTimeRefresh()
+
+#define  SCoopADCSCAN       0        // 0 = no SCoopADC service. otherwise max number of channels in its scan list. on AVR the scan
+                                     // runs from the ADC interrupt (ISR(ADC_vect) is then defined by the library), analogRead() can't be used
+
+#define  SCoopI2CQUEUE      0        // 0 = no SCoopI2C. 2,4,8.. = number of transfers waiting for the bus. on AVR they are driven
+                                     // by the TWI interrupt (ISR(TWI_vect) is then defined by the library, Wire can't be used)
+#define  SCoopI2CSIM        0        // 1 = SCoopI2C talks to SCoopI2CDevice models instead of the TWI hardware, on any platform.
+                                     // extras/host/i2c_sim.cpp runs it on a pc with the x86-64 port (see extras/host/Makefile)
+
+#define  SCoopVIRTUALCLOCK  0        // set to 1 to read all scheduler time through SCoopMillisSource/SCoopMicrosSource, which default 
+                                     // to a virtual clock : each yield() costs mySCoop.virtualCostMicros, and the clock jumps to the next
+                                     // timer or sleep deadline when nothing is runnable (main loop yielding or sleeping).
+                                     // gives repeatable runs, faster than real time
+
 #if (ARDUINO < 103)
 #warning "V1.2 TESTED ONLY ON 1.0.3 with PanSTamp, Arduino UNO, Teensy++2.0, Teensy2.0 and Teensy3.0" 
 #endif
@@ -50,11 +95,11 @@
 #define SCoop_AVR 1                  // inform the library that the code is made for AVR
 
 #define SCDelay_t           int32_t  // type for all the virtual timer used in scoop library (period of timer, sleep function..) 
-#define SCoopTimerCount_t   int32_t  // define the type of the counter used in SCoopTimer. can be changed to int32_t instead
-                                     // these 2 variables could changed to int16_t without any issue !
+                                     // SCoopDelay16 and SCoopTimer16 give 16 bits objects next to the 32 bits ones
 
 #define SCoopDefaultQuantum   400    // recomended before switching to next task. this provide a 5% overhead time used by scheduler, for 3 tasks+loop
 #define SCoopDefaultStackSize 150    // to be experimented by user. seems enough for a task with couple of variable and a call to serial.print
+#define SCoopStackMargin      128    // above a known frame : switch context (21), an isr (~30), a Serial.print(float) chain
 #define AndroidSchedulerDefaultStack SCoopDefaultStackSize
 
 #define micros_t     int16_t         // used for low level time handling. MUST not be changed to int32 
@@ -65,21 +110,81 @@ typedef uint8_t      SCoopStack_t;   // type definition for stack array of bytes
 #define SCoop_ARM 1                  // inform the lbrary that the code is made for ARM // not used yet
 
 #define SCDelay_t           int32_t  // type for all the virtual timer used in scoop library (period of timer, sleep function..)
-#define SCoopTimerCount_t   int32_t  // define the type of the counter used in SCoopTimer. can be changed to int32_t instead
 
 #define SCoopDefaultQuantum   200;   // recomended before switching to next task. this provide a 1% overhead time used by scheduler, for 3 tasks+loop
 #define SCoopDefaultStackSize 256    // must be a multiple of 8
+#define SCoopStackMargin      192    // above a known frame : switch context (56), exception frame (32), print calls
 #define AndroidSchedulerDefaultStack 1024 // a bit too much, just for backward compatibility reason
 
 #define micros_t     int32_t         // all low level micros second computation will be done in 32 bit too. possibility to change to int16
 #define ptrInt       uint32_t        // used to typecast pointers to integer
 typedef uint64_t     SCoopStack_t   __attribute__ ((aligned (8)));
 
+#define SCoopCYCLECOUNTER   1        // 1 = task time and quantum are measured with the DWT cpu cycle counter (or SysTick if no DWT)
+                                     // instead of calling micros() at each yield(). 0 = use micros()
+
+#elif defined(__x86_64__)            // host build, only for the tests in extras/host with their Arduino.h shim
+#define SCoop_HOST 1                 // inform the library that the code runs on a pc : time from the os clock, no interrupt
+
+#define SCDelay_t           int32_t  // type for all the virtual timer used in scoop library (period of timer, sleep function..)
+
+#define SCoopDefaultQuantum   200    // same as ARM
+#define SCoopDefaultStackSize 4096   // printf from the libc needs much more than a core Serial.print. multiple of 16
+#define SCoopStackMargin      2048   // printf again
+#define AndroidSchedulerDefaultStack 8192
+
+#define micros_t     int32_t         // same as ARM
+#define ptrInt       uintptr_t       // pointers are 64 bits
+typedef unsigned __int128 SCoopStack_t;  // 16 bytes aligned, as the abi wants for the stack
+
 #else
 #error "this library might not be compatible with this NON-AVR / ARM platform. Please experiment and report on Arduino.cc forum"
 #endif
 
+#define SCoopTimerCount_t   int32_t  // deprecated, kept for old sketches : a SCoopTimerT<T> counts its occurences in T
+
+#if SCoopVIRTUALCLOCK > 0
+typedef uint32_t (*SCoopTimeFunc_t)(void);   // a time source, same prototype as millis() and micros()
+extern SCoopTimeFunc_t SCoopMillisSource;    // time sources used by the whole library. can be pointed back to millis() and micros()
+extern SCoopTimeFunc_t SCoopMicrosSource;    // or to any user clock. default to the virtual clock below
+extern uint32_t SCoopVirtualMillis();        // the virtual clock, only moved by the functions below or by the scheduler
+extern uint32_t SCoopVirtualMicros();
+extern void     SCoopVirtualAdvance(uint32_t us);
+extern void     SCoopVirtualAdvanceMillis(uint32_t ms);
+#define SCoopDelayMillis()  (SCDelay_t)SCoopMillisSource()
+#else
 #define SCoopDelayMillis()  (SCDelay_t)millis()  // overloading and typecasting the standard millis()
+#endif
+
+#if SCoopCACHEDTIME > 0
+extern SCDelay_t SCoopNowMillis;             // time sampled by SCoopTimeRefresh()
+extern micros_t  SCoopNowMicros;
+extern void      SCoopTimeRefresh();         // sample the live clock now
+#define SCoopCachedMillis() SCoopNowMillis
+#else
+#define SCoopCachedMillis() SCoopDelayMillis()
+#define SCoopTimeRefresh()
+#endif
+
+#if defined(SCoop_ARM) && (SCoopCYCLECOUNTER > 0) && (SCoopVIRTUALCLOCK == 0)
+#define SCoopTICKCYCLES     1        // internal : prevMicros and quantum checks are counted in cpu cycles
+#else
+#define SCoopTICKCYCLES     0        // internal : prevMicros and quantum checks are counted in micros
+#endif
+
+#define SCoopSTRIDEONE      10000    // internal : stride of a task with a share of 1. the pass counts micros * stride
+
+#if (SCoopPREEMPT > 0) && !defined(SCoop_AVR)
+#error "SCoopPREEMPT is only available on AVR : on ARM a switch inside an interrupt would leave the cpu in handler mode"
+#endif
+
+#if (SCoopSTRIDE > 0) && (SCoopADAPTIVEQUANTUM > 0)
+#error "SCoopSTRIDE replaces the cycle : SCoopADAPTIVEQUANTUM can not be used with it"
+#endif
+
+#if (SCoopADAPTIVEQUANTUM > 0) && (SCoopTIMEREPORT == 0)
+#error "SCoopADAPTIVEQUANTUM needs SCoopTIMEREPORT > 0"
+#endif
 
 // some macro for easy code writing, just to replace "Serial." ...
 #define SCbegin(_X)    { Serial.begin(_X);while(!Serial); }
@@ -87,7 +192,7 @@ typedef uint64_t     SCoopStack_t   __attribute__ ((aligned (8)));
 #define SCphex(_X)     { Serial.print(_X,HEX); }
 #define SCpln(_X)      { Serial.println(_X); }
 #define SCplnhex(_X)   { Serial.println(_X,HEX); }
-#define SCkey()        { Serial.print(">?");while (!(Serial.available())) ; SCpln((uint8_t)Serial.read()); }
+#define SCkey()        { Serial.print(">?");while (!(Serial.available())) SCoopInstanceNickName.yield(); SCpln((uint8_t)Serial.read()); }
 #define SCpkey1(_X)    { Serial.print("<");Serial.print(_X);SCkey(); }
 #define SCpkey2(_X,_Y) { Serial.print("<");Serial.print(_X);Serial.print(":");Serial.print(_Y,HEX);SCkey(); }
 
@@ -96,6 +201,7 @@ typedef uint64_t     SCoopStack_t   __attribute__ ((aligned (8)));
 /********* type defs  *******/
 
 typedef void (*SCoopFunc_t)(void); // type definition for a pointer to a function
+typedef void (*SCoopDeferFunc_t)(ptrInt arg); // function called by the scheduler for a SCoopDefer() made in an ISR
 
 typedef volatile int8_t   vi8;     // hope everyone like it
 typedef volatile int16_t  vi16;
@@ -118,18 +224,29 @@ typedef volatile boolean  vbool;
 #define SCoopTRIGGER     B10000    // force object to be launched when calling launch()
 #define SCoopKILLING    B100000    // force object to be killed by Scheduler (or paused if static)
 
+#define SCoopCOUNTNONE   0         // setCounted() modes
+#define SCoopCOUNTEACH   1
+#define SCoopCOUNTALL    2
+
 #define SCoopEventType   1         // used to provide a statical type information to the object in the list (polymorph)
 #define SCoopTaskType    2         // only used by mySCoop.start() in the library code , as virtual call were prefered elsewhere
 #define SCoopTimerType   3         // not used so far
 #define SCoopDynamicTask 4         // 
+#define SCoopStageType   5         // pipeline stage : an event launched when its input has data and its output has room
 
 /********* Objects Prototypes *******/
 
-class SCoopDelay;
-class SCoopDelayus;
+template <class T> class SCoopDelayT;
+template <class T> class SCoopDelayusT;
+typedef SCoopDelayT<SCDelay_t>   SCoopDelay;   // the widths used by the library. see the templates for smaller ones
+typedef SCoopDelayusT<micros_t>  SCoopDelayus;
 class SCoopEvent;
-class SCoopTimer;
+template <class T> class SCoopTimerT;
+typedef SCoopTimerT<SCDelay_t> SCoopTimer;
 class SCoopTask;
+#if SCoopSHAREDSTACK > 0
+class SCoopSharedStack;
+#endif
 class SCoop;
 
 
@@ -145,6 +262,16 @@ extern SCoop SCoopInstanceNickName;       // one forced instance of the SCoop Sc
 extern SCoop& ArduinoSchedulerNickName;   // redundant declaration for compatibilit with the name of the Android/DUE "Scheduler"
 #endif
 
+#if SCoopDEFERSIZE > 0
+extern bool          SCoopDefer(SCoopDeferFunc_t func, ptrInt arg = 0); // can be called from ISR. return false if the queue is full
+extern uint8_t       SCoopDeferCount();   // number of calls waiting in the queue
+extern vui16         SCoopDeferLost;      // number of calls refused because the queue was full
+#endif
+
+#if SCoopPREEMPT > 0
+extern void          SCoopPreempt();      // called by the timer isr : switch the current task if its quantum is spent
+#endif
+
 #if SCoopOVERLOADYIELD == 1
 extern void          yield(void);         // used to overload the Arduino yield "weak"
 extern void          yield0(void);        // used to define our global yield(0)
@@ -194,7 +321,16 @@ class SCoopEvent                      // represent an object in the SCoop list (
   
   void set()   { set(true); }         // force event to be launched by futur yield()
   bool set(bool val)                  // same but possibility to pass an expression
+#if SCoopEVENTCOUNT > 0
+  { if (val) { if (countMode) countUp(); state |= SCoopTRIGGER; }; return val;  }
+
+  void setCounted(uint8_t mode)       // SCoopCOUNTEACH : run() once per set(). SCoopCOUNTALL : run() once for all the pending set(),
+  { countMode = mode; }               // their number is in "triggers". SCoopCOUNTNONE : back to a simple flag
+  
+  uint8_t       triggers;             // number of set() handled by the current run()
+#else
   { if (val) { state |= SCoopTRIGGER; }; return val;  }
+#endif
   
   SCoopClassOperatorEqual(SCoopEvent,bool) // overload operator assignement to make things event simpler
                                        
@@ -211,6 +347,11 @@ class SCoopEvent                      // represent an object in the SCoop list (
 protected:
 
   SCoopFunc_t   userFunc;            // pointer to the user function to call
+#if SCoopEVENTCOUNT > 0
+  vui8          pending;             // number of set() not yet handled, up to 255
+  uint8_t       countMode;
+  void countUp();                    // interrupt safe pending++
+#endif
 
 private:                             // nothing private
                                      // Total object variables = 6 bytes on AVR or 10 on ARM, per object instance
@@ -240,129 +381,216 @@ SCoopClassOperatorEqual(myevent,bool)
 	
 /********* SCOOPDELAY CLASS *******/           // a basic virtual timer solution
 
-class SCoopDelay                               // sort of timerDown... used in SCoopTimer and SCoopTask and sleep
+// T is the signed type of the counter : int8_t, int16_t or int32_t. the clock is read in T too and the remaining time
+// is the difference, so it stays right when the counter wraps. a delay must stay below half the range of T
+// (127ms, 32767ms ...). SCoopDelay is the SCDelay_t version used by the library
+
+template <class T> class SCoopDelayT           // sort of timerDown... used in SCoopTimer and SCoopTask and sleep
 { public:
-  SCoopDelay();                                // basic constructor. set time to 0 . doesnt touch reload variable;
+  SCoopDelayT() { reset(); }                   // basic constructor. set time to 0 . doesnt touch reload variable;
   
-  SCoopDelay(SCDelay_t reload);                // possibility to define reload value, otherwse linker should remove the corresponding code avd variable
+  SCoopDelayT(T reload)                        // possibility to define reload value, otherwse linker should remove the corresponding code avd variable
+  { set(setReload(reload)); }
   
-  SCDelay_t setReload(SCDelay_t reload);       // define the reload period for this object
-  SCDelay_t getReload();                       // return the period variable
-  void     initReload();                       // load the timer with its reload value
-  void     reload();                           // add the reload time to the timer
-  bool     reloaded();                         // return true (only once) each time when "reload" is spent;
+  T setReload(T reload) { return (reloadValue = reload); } // define the reload period for this object
+  T getReload()         { return reloadValue; } // return the period variable
+  void initReload()     { set(reloadValue); }  // load the timer with its reload value
+  void reload()         { timeValue += reloadValue; } // add the reload time to the timer
+  bool reloaded()                              // return true (only once) each time when "reload" is spent;
+  { if (elapsed()) { reload(); return true; }
+    return false; }
   
-  void     reset();                            // reset timer
+  void reset() { set(0); }                     // reset timer
   
-  SCDelay_t set(SCDelay_t time)                // set the time value . return time value . timer will start counting down
-  __attribute__((noinline));                   // we prefer a call to this method as it will take time anyway
+  T set(T time)                                // set the time value . return time value . timer will start counting down
+  __attribute__((noinline))                    // we prefer a call to this method as it will take time anyway
+  { SCoopTimeRefresh();                        // so that a delay never ends early because of the cache
+    return (timeValue = time + (T)SCoopCachedMillis()); }
   
-  SCDelay_t get()                              // return the value corresponding to the remaining time. return 0 if negative
-  __attribute__((noinline));
+  T get()                                      // return the value corresponding to the remaining time. return 0 if negative
+  __attribute__((noinline))
+  { register T temp = (T)(timeValue - (T)SCoopCachedMillis());
+    if (temp < 0) return 0; else return temp; }
+
+  T getLive()                                  // same, but with the live clock even if SCoopCACHEDTIME
+  { SCoopTimeRefresh(); return get(); }
   
-  SCDelay_t add(SCDelay_t time);               // add amount of time to timer, keep timer synchronized with millis.
+  T add(T time) { timeValue += time; return time; } // add amount of time to timer, keep timer synchronized with millis.
   
-  SCDelay_t sub(SCDelay_t time);
+  T sub(T time) { timeValue -= time; return time; }
   
-  bool     elapsed();                          // return true if timer has reached 0. doesnt reload -> use reloaded instead.
+  bool elapsed() { return (get() == 0); }      // return true if timer has reached 0. doesnt reload -> use reloaded instead.
   
-  operator SCDelay_t() { return get(); }       // SCoopDelay can be used in an interger expression
+  operator T() { return get(); }               // SCoopDelay can be used in an interger expression
   
 
-  SCoopClassOperatorEqual(SCoopDelay,SCDelay_t)  // another magic statement 
+  SCoopClassOperatorEqual(SCoopDelayT,T)       // another magic statement 
   
-  SCoopDelay & operator=(const SCoopDelay & rhs) // overload operator assignement 
+  SCoopDelayT & operator=(const SCoopDelayT & rhs) // overload operator assignement 
   { timeValue=rhs.timeValue; return *this; }
   
-  SCoopDelay & operator+=(const SCDelay_t rhs)   // overload operator += to make things event simpler
+  SCoopDelayT & operator+=(const T rhs)        // overload operator += to make things event simpler
   { add(rhs); return *this;}                   
 
-  SCoopDelay & operator-=(const SCDelay_t rhs)   // overload operator -= to make things event simpler
+  SCoopDelayT & operator-=(const T rhs)        // overload operator -= to make things event simpler
   { sub(rhs); return *this;}
   
-  SCDelay_t timeValue;                         // the realtime value of the timer
+  T timeValue;                                 // the realtime value of the timer
 private:
-  SCDelay_t reloadValue;                       // store the period for further reload.
+  T reloadValue;                               // store the period for further reload.
                                                // might be removed by linker, if object instance doesnt use reload function or constructor
 };
 
+typedef SCoopDelayT<int16_t> SCoopDelay16;     // up to 32 seconds, half the ram and much faster on AVR
+typedef SCoopDelayT<int8_t>  SCoopDelay8;      // up to 127 ms
+
 /********* SCOOPDELAYUS CLASS *******/           // a basic virtual timer solution
 
-class SCoopDelayus                               // sort of timerDown... used in SCoopTimer and SCoopTask and sleep
-{ public:
-  SCoopDelayus();                                // basic constructor. set time to 0 . doesnt touch reload variable;
+// same in micros. T is a signed type not wider than micros_t (16 bits on AVR), as the micros clock of the library
+// rolls over at that width : int8_t, int16_t, and int32_t on ARM. set() and get() are compiled in SCoop.cpp, with this
+// clock inlined, for each of these widths. another type does not compile
+
+template <class T> class SCoopDelayusT         // sort of timerDown... used in SCoopTimer and SCoopTask and sleep
+{ typedef char widthCheck[((sizeof(T) <= sizeof(micros_t)) && ((T)-1 < 0)) ? 1 : -1]; // signed, not wider than micros_t
+  public:
+  SCoopDelayusT() { reset(); }                 // basic constructor. set time to 0 . doesnt touch reload variable;
   
-  SCoopDelayus(micros_t reload);                // possibility to define reload value, otherwse linker should remove the corresponding code avd variable
+  SCoopDelayusT(T reload)                      // possibility to define reload value, otherwse linker should remove the corresponding code avd variable
+  { set(setReload(reload)); }
   
-  micros_t setReload(micros_t reload);       // define the reload period for this object
-  micros_t getReload();                       // return the period variable
-  void     initReload();                       // load the timer with its reload value
-  void     reload();                           // add the reload time to the timer
-  bool     reloaded();                         // return true (only once) each time when "reload" is spent;
+  T setReload(T reload) { return (reloadValue = reload); } // define the reload period for this object
+  T getReload()         { return reloadValue; } // return the period variable
+  void initReload()     { set(reloadValue); }  // load the timer with its reload value
+  void reload()         { timeValue += reloadValue; } // add the reload time to the timer
+  bool reloaded()                              // return true (only once) each time when "reload" is spent;
+  { if (elapsed()) { reload(); return true; }
+    return false; }
   
-  void     reset();                            // reset timer
+  void reset() { set(0); }                     // reset timer
   
-  micros_t set(micros_t time)                // set the time value . return time value . timer will start counting down
-  __attribute__((noinline));                   // we prefer a call to this method as it will take time anyway
+  T set(T time);                               // set the time value . return time value . timer will start counting down
   
-  micros_t get()                              // return the value corresponding to the remaining time. return 0 if negative
-  __attribute__((noinline));
+  T get();                                     // return the value corresponding to the remaining time. return 0 if negative
+
+  T getLive()                                  // same, but with the live clock even if SCoopCACHEDTIME
+  { SCoopTimeRefresh(); return get(); }
   
-  micros_t add(micros_t time);               // add amount of time to timer, keep timer synchronized with millis.
+  T add(T time) { timeValue += time; return time; } // add amount of time to timer, keep timer synchronized with millis.
   
-  micros_t sub(micros_t time);
+  T sub(T time) { timeValue -= time; return time; }
   
-  bool     elapsed();                          // return true if timer has reached 0. doesnt reload -> use reloaded instead.
+  bool elapsed() { return (get() == 0); }      // return true if timer has reached 0. doesnt reload -> use reloaded instead.
   
-  operator micros_t() { return get(); }       // SCoopDelay can be used in an interger expression
+  operator T() { return get(); }               // SCoopDelay can be used in an interger expression
   
 
-  SCoopClassOperatorEqual(SCoopDelayus,micros_t)  // another magic statement 
+  SCoopClassOperatorEqual(SCoopDelayusT,T)     // another magic statement 
   
-  SCoopDelayus & operator=(const SCoopDelay & rhs) // overload operator assignement 
+  SCoopDelayusT & operator=(const SCoopDelayusT & rhs) // overload operator assignement 
   { timeValue=rhs.timeValue; return *this; }
   
-  SCoopDelayus & operator+=(const micros_t rhs)   // overload operator += to make things event simpler
+  SCoopDelayusT & operator+=(const T rhs)      // overload operator += to make things event simpler
   { add(rhs); return *this;}                   
 
-  SCoopDelayus & operator-=(const micros_t rhs)   // overload operator -= to make things event simpler
+  SCoopDelayusT & operator-=(const T rhs)      // overload operator -= to make things event simpler
   { sub(rhs); return *this;}
   
 private:
-  micros_t timeValue;                         // the realtime value of the timer
-  micros_t reloadValue;                       // store the period for further reload.
+  T timeValue;                                 // the realtime value of the timer
+  T reloadValue;                               // store the period for further reload.
                                                // might be removed by linker, if object instance doesnt use reload function or constructor
 };
 
+typedef SCoopDelayusT<int8_t> SCoopDelayus8;   // up to 127 us
+
 	
 /********* SCoopTIMER CLASS *******/
 
-class SCoopTimer : public SCoopEvent
+// the part of a timer which does not depend on the counter width. the scheduler sees every timer through it
+
+class SCoopTimerBase : public SCoopEvent
 { public:
-  SCoopTimer();                                // constructor
-  SCoopTimer(SCDelay_t period);
-  SCoopTimer(SCDelay_t period, SCoopFunc_t func);
-  
-  void  init(SCDelay_t period, SCoopFunc_t func); // user function only
+  SCoopTimerBase();
+
+  virtual SCDelay_t getTimeToRun() = 0;        // return the value corresponding to the time when the timer will be launched
+  virtual void setTimeToRun(SCDelay_t time) = 0; // set the next launch time to happen in "time" ms
+  virtual SCDelay_t getPeriod() = 0;
+#if SCoopTIMERSLACK > 0
+  void setSlack(uint16_t ms) { slackMillis = ms; } // before start(). the period stays the same, only a launch can be early.
+                                               // start() also aligns the phase on a started timer with slack and harmonic period
+  uint16_t slackMillis;
+protected:
+  void alignPhase();
+  void batchDue();                             // this timer is due : the ones within their slack can join it
+  bool batchEarly(SCDelay_t left);             // true if this timer, due in "left" ms, can join the timers due now
+#endif
+};
 
-  void setTimeToRun(SCDelay_t time);            // set the next launch time to happen in "time" ms
-  SCDelay_t getTimeToRun();                     // return the value corresponding to the time when the timer will be launched
-  
-  void schedule(SCDelay_t time);                // plan the next launch (same as SetTimeToRun in fact, but force counter to -1
-  void schedule(SCDelay_t time, SCoopTimerCount_t count); // same but with a limited number of occurences (count)
+// T is the signed type of the period and of the occurence count of schedule(time, count) : both are limited to the
+// positive range of T, 127 for SCoopTimer8, 32767 for SCoopTimer16
 
-  virtual void start();                        // initialize timer and make it ready for launch
-  virtual bool launch();                       // launch the run() if time ellapsed and not paused
+template <class T> class SCoopTimerT : public SCoopTimerBase
+{ public:
+  SCoopTimerT()                                // constructor
+  { init(0, NULL); }
+  SCoopTimerT(T period)
+  { init(period, NULL); }
+  SCoopTimerT(T period, SCoopFunc_t func)
+  { init(period, func); }
+  
+  void init(T period, SCoopFunc_t func)        // user function only
+  { counter = -1;
+    timer.setReload(period); timer.reset(); 
+    userFunc = func; 
+    if (func != NULL) 
+       state = SCoopNEW; }                     // we can use this NEW state as the user function is now defined
+
+  void setTimeToRun(SCDelay_t time)            // set the next launch time to happen in "time" ms
+  { timer.set(time); }
+  SCDelay_t getTimeToRun()                     // return the value corresponding to the time when the timer will be launched
+  { if ((counter == 0) || (timer.getReload() == 0)) return -1;
+    return timer.get(); }
+  SCDelay_t getPeriod()
+  { return timer.getReload(); }
+  
+  void schedule(T time)                        // plan the next launch (same as SetTimeToRun in fact, but force counter to -1
+  { schedule(time, -1); }
+  void schedule(T time, T count)               // same but with a limited number of occurences (count)
+  { timer.set(timer.setReload(time)); counter = count; }
+
+  virtual void start()                         // initialize timer and make it ready for launch
+  { SCoopEvent::start(); 
+    timer.initReload();                        // make sure the timer is starting with the reload period value
+#if SCoopTIMERSLACK > 0
+    if (slackMillis) alignPhase();
+#endif
+  }
+
+  virtual bool launch()                        // launch the run() if time ellapsed and not paused
+  { if ((counter == 0) || (timer.getReload() == 0)) return false;
+    register bool due = timer.reloaded();
+#if SCoopTIMERSLACK > 0
+    if (due) batchDue();
+    else if (slackMillis && batchEarly(timer.get())) {
+       timer.reload(); due = true; }           // early, but the next period is still counted from the normal time
+#endif
+    if (due) {
+       state |= SCoopTRIGGER;
+       register bool launched = SCoopEvent::launch();
+       if ((launched ) && (counter > 0)) counter--;
+       return launched; }                      // rearm next run time so timers are NOT desynchronized by pause(). (my default choice)
+    return false; }
 
   operator SCDelay_t(){ return getTimeToRun(); }
                                                // all other virtual methods are inherited from Event, included run()
 private:
-  void initBasic();
-  SCoopDelay timer;                            // virtual timer used for identifting when Timer object should be launched
-  SCoopTimerCount_t counter;                   // by defaut = -1. if >0 then represent the max number of futur occurences
-                                               // ptrInt will force 16 bits for AVR (new in V1.2) and 32 for ARM
+  SCoopDelayT<T> timer;                        // virtual timer used for identifting when Timer object should be launched
+  T counter;                                   // by defaut = -1. if >0 then represent the max number of futur occurences
 };
 
+typedef SCoopTimerT<int16_t> SCoopTimer16;     // periods up to 32 seconds : 16 bits math and 4 bytes less per timer on AVR
+typedef SCoopTimerT<int8_t>  SCoopTimer8;      // periods up to 127 ms. schedule(time, count) is limited to 127 occurences too
+
 
 /******* MACRO FOR CREATING TIMER OBJECTS Easily ******/
 // define an object class inheriting from SCoopTimer
@@ -440,18 +668,73 @@ class SCoopTask : public SCoopEvent
 
   bool sleepUntil(vbool& var, SCDelay_t timeOut);  // same, with timeout. return true, if the var was set true
   
-  ptrInt stackLeft();                        // remaining stack space in this task
+  ptrInt stackLeft();                        // remaining stack space in this task (in the shared stack, for all its tasks)
+#if SCoopSHAREDSTACK > 0
+  void shareStack(SCoopSharedStack& shared, SCoopStack_t* save, ptrInt saveSize); // run on the shared stack instead of a
+                                             // dedicated one. "save" receives the used part when another task takes the stack.
+                                             // must be called before start(). savePeak gives the size really needed
+  SCoopSharedStack* shared;                  // NULL for a task with its own stack
+  uint8_t *    saveAddr;
+  ptrInt       saveSize;
+  ptrInt       savePeak;                     // highest number of bytes saved
+#endif
 #if SCoopANDROIDMODE >= 2
     void kill();                               // only works in conjunction with SCoop::startLoop for dynamic tasks
 #endif  
+#if SCoopEDF > 0
+  bool setPeriod(SCDelay_t period, SCDelay_t deadline = 0, uint32_t cost = 0); // loop() will be called once per period (ms) and
+                                             // should end before deadline (ms, default = period). cost is the expected time for a loop()
+                                             // in micros, it will be replaced by the measured one if higher. return false if the total
+                                             // utilization would exceed SCoopEDFCAPACITY, the task then stays a normal task
+  void clearPeriod();                        // back to a normal task
+#endif
+#if SCoopSTRIDE > 0
+  void setShare(uint16_t share);             // relative part of the cpu time for this task, 1 to 1000 (50, 30, 20 = 50%, 30%, 20%)
+#if SCoopTIMEREPORT > 0
+  uint16_t reservedShare();                  // share of this task among the tasks not paused, in 1/1000 : the part it gets when all need the cpu
+  uint16_t measuredShare();                  // time really spent in this task, in 1/1000 of the time spent in all the tasks
+#endif
+#endif
+#if SCoopPREEMPT > 0
+  friend void SCoopPreempt();
+#endif
+#if (SCoopVIRTUALCLOCK > 0) || (SCoopADAPTIVEQUANTUM > 0) || (SCoopEDF > 0) || (SCoopSTRIDE > 0)
+  friend class SCoop;                        // the scheduler reads the sleep timer and the time spent in the cycle
+#endif
   uint8_t *    pStack;                       // always point back and forth to the SP register for this task
   uint8_t *    pStackAddr;                   // keep a copy of the lowest stack adress. only used by stackleft()
   micros_t     quantumMicros;                // copy of the SCoopQuantum global definition, so the user can overload the value in setup()
-  micros_t     prevMicros;                   // memorize the value of the micros() counter when entering the task. Works with quantumMicros
+  micros_t     prevMicros;                   // memorize the value of the micros() counter (or cpu cycles if SCoopTICKCYCLES) when entering the task
   
 #if SCoopTIMEREPORT > 0                      // verifiy if we want to measure timing
   micros_t     yieldMicros;                  // time spent in the task during 1 complete scheduler cycle (average)
   micros_t     maxYieldMicros;               // maximum average amount of time spent in the task
+#if SCoopTICKCYCLES > 0
+  uint32_t     yieldCycles;                  // total cpu cycles spent in the task since start (rolls over)
+#endif
+#endif
+#if SCoopADAPTIVEQUANTUM > 0
+  micros_t     shareMicros;                  // time expected in the task for each cycle. set to the quantum by start()
+  micros_t     minQuantumMicros;             // bounds for the adaptive quantum. default to share/4 and share*2 if 0 in setup()
+  micros_t     maxQuantumMicros;
+  micros_t     cycleTicks;                   // time spent in the task since the begining of the current cycle (in ticks)
+#endif
+#if SCoopSTRIDE > 0
+  uint16_t     share;
+  uint16_t     stride;                       // SCoopSTRIDEONE / share : cost of one micro second in this task
+  uint32_t     pass;                         // time spent in the task, each micro second counted "stride" times. the lowest runs next
+#if SCoopTIMEREPORT > 0
+  uint32_t     spentMicros;                  // time spent in the task. all are halved together before overflow
+#endif
+#endif
+#if SCoopEDF > 0
+  SCDelay_t    periodMillis;                 // 0 for a normal task
+  SCDelay_t    deadlineMillis;               // deadline relative to the release of each loop()
+  SCDelay_t    releaseMillis;                // time when the current loop() was released
+  uint32_t     costMicros;                   // highest time spent in a loop(), measured or given to setPeriod()
+  uint16_t     utilization;                  // cost / deadline, in 1/1000
+  uint16_t     deadlineMisses;               // number of loop() which ended after their deadline, or were skipped
+  uint32_t     jobTicks;                     // time spent in the current loop() (in ticks). 32 bits : a loop() can last more than 32ms on AVR
 #endif
   
 protected:                                   // members below can be overidedn in a user object, if neded
@@ -478,6 +761,9 @@ private:  // only internal methods used to optimize code size or readabilty
   
   void yieldSwitch()                         // just do it when you want to go to it
   __attribute__((noinline));
+#if SCoopEDF > 0
+  void endJob();                             // end of loop() for a periodic task : check deadline, then wait next release
+#endif
   
   inline void startFirstLoop()               // only used to simplify code reading. most likely the compiler will inline them
   __attribute__((always_inline));            // internal use only, to split cod into eementary function, facilitate inlining
@@ -493,6 +779,11 @@ private:  // only internal methods used to optimize code size or readabilty
 // define a stack as a static array , taking care of stack allignement
 #define defineStack(x,y) static SCoopStack_t x [ (  y + sizeof(SCoopStack_t) -1)/ sizeof(SCoopStack_t)];
 
+// stack of a task when only its own frame is known (from -fstack-usage), not what it calls : SCoopStackMargin on top,
+// rounded to 8, and never less than SCoopDefaultStackSize. a size measured with stackLeft() can be used as it is
+#define SCoopFrameStackSize(frame) ( ((((frame) + SCoopStackMargin + 7) & ~7) > SCoopDefaultStackSize) ? \
+        (((frame) + SCoopStackMargin + 7) & ~7) : SCoopDefaultStackSize )
+
 /******* MACRO FOR CREATING TASK OBJECTS Easily ******/
 
 // define a new object class inheriting from the SCoopTask object
@@ -526,6 +817,41 @@ class mytask : public SCoopTask \
         defineTaskLoop_Size(__VA_ARGS__),\
         defineTaskLoop_(__VA_ARGS__)) 
 
+
+/******* SHARED STACK ******/
+
+#if SCoopSHAREDSTACK > 0
+// one large stack used in turn by several tasks. the task whose context is in it is the owner. when another task
+// is launched, the owner used part (from its pStack to the top) is copied to its save area, and the new task
+// saved bytes are copied back at the same adresses. a task alone on its shared stack never copies anything.
+// tasks sharing a stack always go back to the scheduler instead of switching directly to the next task.
+
+class SCoopSharedStack
+{public:
+  SCoopSharedStack(SCoopStack_t* stack, ptrInt size);
+  bool evict();                              // save the owner context. false if its save area is too small
+  uint8_t*   bottom;
+  uint8_t*   top;                            // initial pStack of each task using this stack
+  SCoopTask* owner;                          // task whose context is in the stack, or NULL
+  uint16_t   overflows;                      // launches delayed because the owner used more than its save area
+  uint16_t   swaps;                          // number of owner changes
+};
+
+#define defineSharedStack( name , size ) \
+defineStack( name##Stack , size ) \
+SCoopSharedStack name ( & name##Stack [0] , size );
+
+// same as defineTask and defineTaskLoop, with a save area of savesize bytes instead of a stack
+#define defineTaskSharedBegin( mytask , shared , savesize ) \
+defineStack( mytask##Save , savesize ) \
+class mytask : public SCoopTask \
+{ public: mytask () : SCoopTask() { shareStack( shared , & mytask##Save [0] , savesize ); state = SCoopNEW; };
+
+#define defineTaskShared( task , shared , savesize ) defineTaskSharedBegin( task , shared , savesize ) void setup(); void loop(); defineTaskEnd(task)
+
+#define defineTaskLoopShared( task , shared , savesize ) defineTaskShared( task , shared , savesize ) void task :: setup() { }; void task :: loop()
+#endif
+
 	
 /******* MAIN SCoop CLASS ******/
 
@@ -543,7 +869,7 @@ class SCoop                            // used only once for instanciating "mySC
   void yield();                        // can be called from where ever in order to Force the switch to next task
   void yield0();                       // can be called from where ever in order to Force the switch to next task
   void sleep(SCDelay_t time);          // quick implementation of a delay() type of function, in case the standard Arduino delay doesnt contain yield()
-  void delay(uint32_t ms);             // same code as in Arduino 1.5
+  void delay(uint32_t ms);             // same as sleep(), for compatibility with Arduino 1.5 Scheduler
   
   uint8_t*    mainEnv;                 // used to store the main Stack register of the main loop()
   SCoopEvent* Current;                 // curent task in the yield cycle
@@ -558,6 +884,45 @@ class SCoop                            // used only once for instanciating "mySC
 #if SCoopTIMEREPORT > 0                // verifiy if we want to measure timing
   micros_t     cycleMicros;            // total cycle time (average) for N cycle 
   micros_t     maxCycleMicros;         // maximum average amount of time spent in a full cycle
+#endif
+#if SCoopEDF > 0
+  uint32_t    edfLoad;                 // sum of the utilization of the periodic tasks, in 1/1000. can go above capacity if overloaded
+  uint16_t    edfOverloads;            // number of times a measured cost pushed edfLoad above SCoopEDFCAPACITY
+  bool edfOverloaded() { return edfLoad > SCoopEDFCAPACITY; } // deadlines can be missed : setPeriod() only checked the given costs
+  uint8_t     edfTasks;                // number of periodic tasks
+  SCDelay_t   edfNext;                 // earliest time when a periodic task could be ready
+  bool edfPending() { return edfTasks && ((SCDelay_t)(SCoopCachedMillis() - edfNext) >= 0); }
+private:
+  bool edfLaunch();                    // launch the ready periodic task with the earliest deadline. false if none
+public:
+#endif
+#if SCoopSTRIDE > 0
+  uint32_t    stridePass;              // pass of the last task launched : a task coming back from a pause or a sleep starts there
+private:
+  void strideLaunch();                 // launch the runnable task with the lowest pass, after checking the sleeping ones
+  void strideRun(SCoopTask* task);
+public:
+#endif
+#if SCoopPREEMPT > 0
+  uint16_t    preemptions;             // number of tasks switched by the timer interrupt
+#endif
+#if SCoopTIMERSLACK > 0
+  bool        timerBatch;              // a timer was due in this pass : the ones within their slack join it
+  bool        timerBatchNext;          // same for the next pass, for the timers placed before in the list
+  uint16_t    timerWakeups;            // number of passes where at least one timer was due
+#endif
+#if SCoopADAPTIVEQUANTUM > 0
+private:
+  void adaptQuantum();                 // correct each task quantum from the time really spent in the completed cycle
+public:
+#endif
+#if SCoopVIRTUALCLOCK > 0
+  micros_t     virtualCostMicros;      // virtual time charged for each call to yield(), so that busy loops also see time passing
+  SCoopDelay*  mainTimer;              // the timer of the main loop when it is inside sleep() or delay(), NULL otherwise
+  bool         virtualJumpLoop;        // true (default) : also jump while loop() only calls yield(). set to false if loop()
+                                       // has its own work between the deadlines, it then only sees yield() costs passing
+private:
+  void virtualJump();                  // move the virtual clock to the nearest deadline if nothing is runnable
 #endif
                                        // total variable size : 13 to 19 bytes on ARM, 25 to 37 bytes on ARM
 };
@@ -596,6 +961,44 @@ uint8_t inline __SCoopNoInterrupts(void)              { noInterrupts(); return 1
 #define ASM_ATOMIC for ( uint8_t __temp __attribute__((__cleanup__(__SCoopInterrupts))) = __SCoopNoInterrupts(); __temp  ; __temp = 0 )
 #endif
 
+/*************** SCoopSHARED TEMPLATE ******************/
+
+// a value of any type shared between one writer (task, timer or isr) and any number of readers, without masking interrupts.
+// two copies : the writer fills the one not published, then flips the 8 bits sequence number (atomic on AVR).
+// a reader copies the published one and starts again if a write happened meanwhile. an isr reading while a task
+// is writing gets the previous value at the first try, so no isr can wait on a task.
+
+template <class T> class SCoopShared
+{public:
+  SCoopShared()               { seq = 0; }
+  SCoopShared(const T& value) { buffer[0] = value; seq = 0; }
+
+  void write(const T& value)        // only one writer at a time
+  { register uint8_t next = seq + 1;
+    buffer[next & 1] = value;
+    asm volatile ("" ::: "memory");  // the copy is complete before the new sequence is seen
+    seq = next; }
+
+  T read()
+  { T value; register uint8_t s;
+    do { s = seq;
+         asm volatile ("" ::: "memory");
+         value = buffer[s & 1];
+         asm volatile ("" ::: "memory"); }
+    while (s != seq);                // the writer started on our copy meanwhile : read the new one
+    return value; }
+
+  uint8_t version() { return seq; }  // changes with each write, to check if there is something new without reading
+
+  operator T() { return read(); }
+  SCoopShared& operator=(const T& value) { write(value); return *this; }
+
+private:
+  T buffer[2];
+  volatile uint8_t seq;
+  };
+
+
 /*************** SCoopFIFO CLASS ******************/
 
 // easy way of handling tx rx buffers for bytes, int or long or any structure < 256 bytes
@@ -623,6 +1026,13 @@ class SCoopFifo
   
   operator uint16_t() { return count(); }
 
+  uint16_t room();                    // number of items that can be put before the buffer is full
+
+  uint16_t readSpan(void** items);    // give the address of the older item and the number of items readable from there without wrapping
+  void     readDone(uint16_t number); // release the number of items read in the span
+  uint16_t writeSpan(void** items);   // same for the free space : address where to write and number of items writable in one block
+  void     writeDone(uint16_t number); // publish the number of items written in the span
+
 private:
 
   void getYield(void* var);          // return an item and potentially wait until it is available. calls yield() in the meantime
@@ -640,10 +1050,420 @@ private:
 type name##type##number [ number ]; \
 SCoopFifo name ( name##type##number , sizeof( type ), number );
 
+
+/*************** SCoopBROADCAST CLASS ******************/
+
+// one producer (task, timer or isr) publishes items that every subscriber reads, in place, with its own cursor.
+// the writer never waits : a subscriber which is too slow loses the oldest items and counts them.
+// itemNumber-1 items can be waiting for a subscriber, the last slot is the one being written
+
+class SCoopBroadcast
+{public:
+  SCoopBroadcast(void * buffer, const uint8_t itemSize, const uint16_t itemNumber);
+
+  void* writeItem();                  // address of the slot for the next item, to fill in place before publish()
+  void  publish();                    // make the item written visible to all the subscribers
+  void  put(const void* var);         // copy one item and publish it
+
+  uint16_t published();               // number of items published since the start (wraps)
+
+private:
+  friend class SCoopSubscriber;
+  uint8_t* volatile ptrIn;            // slot of the next item
+  volatile uint16_t seq;              // sequence number of the next item
+  uint8_t  itemSize;
+  uint16_t itemNumber;
+  uint8_t* ptrMin;
+  uint8_t* ptrMax;
+  };
+
+
+class SCoopSubscriber
+{public:
+  SCoopSubscriber(SCoopBroadcast& channel); // starts with the next item published
+
+  uint16_t available();               // number of items to read. jumps over the items already overwritten
+  const void* peek();                 // address of the next item in the buffer, NULL if none
+  bool next();                        // release the item peeked. false if the writer overwrote it meanwhile
+  bool get(void* var);                // copy the next item. false if none or if it was overwritten during the copy
+
+  uint16_t lost;                      // number of items overwritten before being read
+
+private:
+  uint16_t sync(const void** item);   // skip the items overwritten, give the next item and the number available
+  SCoopBroadcast* channel;
+  uint16_t seq;                       // sequence number of the next item to read
+  };
+
+#define defineBroadcast( name , type , number ) \
+type name##type##number [ number ]; \
+SCoopBroadcast name ( name##type##number , sizeof( type ), number );
+
+
+/*************** SCoopSTAGE CLASS ******************/
+
+// a pipeline is a chain of stages connected by fifos : source -> filter -> sink. a stage is launched by yield() only
+// when its input fifo has an item (or it has no input) and its output fifo has room (or it has no output).
+// so a slow sink leaves its input full, which stops the stage before it, up to the source : nothing is lost.
+// run() should use get() and put(), which count the items, and loop while ready() to treat a whole batch.
+// a source stage can have a period in ms : it is then launched at most once per period, and waits for room.
+
+class SCoopStage : public SCoopEvent
+{ public:
+  SCoopStage(SCoopFifo* input, SCoopFifo* output, SCDelay_t period = 0, SCoopFunc_t func = NULL);
+
+  bool get(void* item);                        // read one item from input. false if empty
+  bool put(void* item);                        // write one item to output. false if full
+  bool ready();                                // input has an item and output has room
+
+  virtual void start();
+  virtual bool launch();                       // run() only if ready() and period elapsed
+
+  SCDelay_t getTimeToRun();                    // -1 if not ready, otherwise time before the period is elapsed
+
+  SCoopFifo* input;                            // NULL for a source
+  SCoopFifo* output;                           // NULL for a sink
+  uint32_t   itemsIn;                          // throughput counters, can be reset by the user
+  uint32_t   itemsOut;
+  uint16_t   runs;
+  uint16_t   blocked;                          // launches refused because output was full while input had data
+private:
+  SCoopDelay timer;
+};
+
+#define defineStageBegin(stage, input, output, period) \
+class stage : public SCoopStage \
+{public: stage () : SCoopStage( input, output, period ) { state = SCoopNEW; };
+
+#define defineStageEnd(stage) }; stage stage ;
+
+#define defineStage_Period(stage, input, output, period) defineStageBegin(stage, input, output, period) void setup(); void run(); defineStageEnd(stage)
+#define defineStage_(stage, input, output) defineStage_Period(stage, input, output, 0)
+
+#define defineStage_X(x,A,B,C,D,FUNC, ...)  FUNC  // trick to create macro with optional arguments
+#define defineStage(...)  defineStage_X(,##__VA_ARGS__, \
+        defineStage_Period(__VA_ARGS__),\
+        defineStage_(__VA_ARGS__),,)
+
+// quick definition of a stage with the bloc code of its run(). use NULL for a missing fifo :
+// defineStageRun(filter, &fifoRaw, &fifoAvg) { int16_t x; while (ready()) { get(&x); ... put(&y); } }
+
+#define defineStageRun_Period(stage, input, output, period) defineStageBegin(stage, input, output, period) void run(); defineStageEnd(stage) void stage :: run()
+#define defineStageRun_(stage, input, output) defineStageRun_Period(stage, input, output, 0)
+
+#define defineStageRun_X(x,A,B,C,D,FUNC, ...)  FUNC
+#define defineStageRun(...)  defineStageRun_X(,##__VA_ARGS__, \
+        defineStageRun_Period(__VA_ARGS__),\
+        defineStageRun_(__VA_ARGS__),,)
+
+
+/*************** DSP STAGES ON FIFO ******************/
+
+// fixed point filters working on int16_t samples by blocks : run() takes the contiguous span of the input fifo
+// and, if given, writes the results directly in the output fifo span. one call per task cycle treats every
+// sample received since the last one, instead of one get() and one yield check per sample.
+// the input and output fifos must be defined with int16_t items.
+
+class SCoopDSPStage
+{public:
+  SCoopDSPStage() { value = 0; samples = 0; }
+  uint16_t run(SCoopFifo& in, SCoopFifo* out = NULL, uint16_t max = 0xFFFF); // return number of input samples consumed
+  virtual uint16_t process(const int16_t* in, int16_t* out, uint16_t number) = 0; // out can be NULL. return number of results
+  int16_t  value;                             // last result
+  uint32_t samples;                           // total number of input samples processed
+};
+
+class SCoopEMA : public SCoopDSPStage        // exponential moving average : avg += x - avg/2^shift
+{public:
+  SCoopEMA(uint8_t shift) { this->shift = shift; acc = 0; }
+  uint16_t process(const int16_t* in, int16_t* out, uint16_t number);
+  uint8_t  shift;
+  int32_t  acc;                               // average * 2^shift
+};
+
+class SCoopMovingAverage : public SCoopDSPStage // average of the 2^shift last samples, history starts with zeros
+{public:
+  SCoopMovingAverage(int16_t* history, uint8_t shift); // shift up to 15
+  uint16_t process(const int16_t* in, int16_t* out, uint16_t number);
+private:
+  int16_t* history;
+  uint8_t  shift;
+  uint16_t index;
+  int32_t  sum;
+};
+
+class SCoopMedian : public SCoopDSPStage     // median of the "length" last samples (odd, up to 255), rejects spikes
+{public:
+  SCoopMedian(int16_t* buffer, uint8_t length); // buffer of 2*length : history then sorted copy
+  uint16_t process(const int16_t* in, int16_t* out, uint16_t number);
+private:
+  int16_t* history;
+  int16_t* sorted;
+  uint8_t  length;
+  uint8_t  index;
+};
+
+class SCoopDecimator : public SCoopDSPStage  // one result, the average, every "factor" samples
+{public:
+  SCoopDecimator(uint8_t factor) { this->factor = factor; count = 0; sum = 0; }
+  uint16_t process(const int16_t* in, int16_t* out, uint16_t number);
+  uint8_t  factor;
+private:
+  uint8_t  count;
+  int32_t  sum;
+};
+
+class SCoopWindow : public SCoopDSPStage     // min, max, mean and rms of consecutive windows of "length" samples
+{public:
+  SCoopWindow(uint16_t length);
+  uint16_t process(const int16_t* in, int16_t* out, uint16_t number); // out receives the rms of each window
+  uint16_t length;
+  int16_t  minimum, maximum, mean;            // results of the last complete window
+  uint16_t rms;                               // also in value
+  uint16_t windows;                           // number of windows completed
+private:
+  uint16_t count;
+  int16_t  curMin, curMax;
+  int32_t  sum;
+  uint64_t sumSquares;
+};
+
+#define defineMovingAverage( name , shift ) \
+typedef char name##shiftCheck [ ((shift) <= 15) ? 1 : -1 ]; /* the history index is 16 bits */ \
+int16_t name##history [ 1U << (shift) ]; \
+SCoopMovingAverage name ( name##history , shift );
+
+#define defineMedian( name , length ) \
+int16_t name##buffer [ 2 * (length) ]; \
+SCoopMedian name ( name##buffer , length );
+
+
+/*************** SCoopLOG CLASS ******************/
+
+// replacement for SCp() in time critical code : put() only records the address of the format string (kept in flash)
+// and the raw 32 bits arguments. the text is built later by print(), typically from a low priority task,
+// or not at all if write() sends the binary record to a host decoder which gets the strings from the .elf file.
+// put() must not be called from an ISR (see SCoopDefer). floats must be passed with SCoopLogFloat(x).
+// a record is written completely before it is published, and put() from several tasks are serialized.
+// on AVR print() reads the format from flash : always use SCoopLogPut(), which wraps it in PSTR().
+// calling put() directly with a string in RAM would print whatever is at the same address in flash
+
+#ifndef PSTR
+#define PSTR(s) (s)
+#endif
+
+#define SCoopLogPut(log, fmt, ...) log.put(PSTR(fmt), ##__VA_ARGS__)   // fmt accepts %d %i %u %x %c %f %% (l is ignored)
+
+inline uint32_t SCoopLogFloat(float x) { union { float f; uint32_t u; } v; v.f = x; return v.u; }
+
+class SCoopLog
+{public:
+  SCoopLog(void * buffer, const uint16_t size);
+  
+  bool put(const char* fmt);          // record a message. return false if the buffer was full (counted in lost). on AVR fmt
+                                      // must be in flash : use SCoopLogPut() rather than put()
+  bool put(const char* fmt, uint32_t a);
+  bool put(const char* fmt, uint32_t a, uint32_t b);
+  bool put(const char* fmt, uint32_t a, uint32_t b, uint32_t c);
+  bool put(const char* fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
+  
+  bool print(Print& out);             // format and print the oldest message. return false if there was none
+  bool write(Print& out);             // send the oldest message as 0xA5, fmt address, number of args, args (little endian)
+  
+  uint16_t count();                   // number of bytes waiting in the buffer
+  operator uint16_t() { return count(); }
+  
+  vui16    lost;                      // number of messages dropped because the buffer was full
+
+private:
+  bool    putArgs(const char* fmt, uint8_t n, const uint32_t* args);
+  bool    getRecord(const char* * fmt, uint8_t* n, uint32_t* args);
+  void    putByte(uint16_t& index, uint8_t value);
+  uint8_t getByte(uint16_t& index);
+  
+  uint8_t* buffer;
+  uint16_t size;
+  volatile uint16_t in;
+  volatile uint16_t out;
+};
+
+#define defineLog( name , size ) \
+uint8_t name##Buffer [ size ]; \
+SCoopLog name ( name##Buffer , size );
+
+
+/*************** SCoopSTREAM CLASS ******************/
+
+// Stream wrapper for Serial (or any Stream) : instead of spinning inside the core when the tx buffer is full,
+// write() calls yield() until there is room, so the other tasks keep running during the character times.
+// the core serial drivers have no hook for their tx/rx interrupt, so the waiting task polls the buffer once per yield.
+// room is known with Print::availableForWrite(), used only on Teensy and with the AVR core of Arduino 1.8 or later :
+// the early 1.6.x cores have it in HardwareSerial only, not in Print, and the other cores are not checked.
+// elsewhere, or with a stream which always returns 0, writes go straight to the port as before.
+
+#if (defined(SCoop_AVR) && (ARDUINO >= 10800)) || defined(TEENSYDUINO)
+#define SCoopStreamFree(port) (port).availableForWrite()
+#else
+#define SCoopStreamFree(port) 0
 #endif
-<<<<<<< HEAD
 
-=======
+class SCoopStream : public Stream
+{public:
+  SCoopStream(Stream& port) : port(port) { maxFree = 0; }
+  
+  virtual size_t write(uint8_t value);                        // yield until there is room for the byte
+  virtual size_t write(const uint8_t *buffer, size_t size);  // bulk write, yield each time the tx buffer is full
+  size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+  
+  bool   tryWrite(uint8_t value);                             // never wait. return false if the tx buffer is full
+  size_t tryWrite(const uint8_t *buffer, size_t size);       // write only what fits now. return the number of bytes written
+  
+  virtual int  available()     { return port.available(); }
+  virtual int  read()          { return port.read(); }     // -1 if nothing, as usual
+  virtual int  peek()          { return port.peek(); }
+  virtual void flush();                                       // yield until the tx buffer is empty
+  int          readWait();                                    // yield until a byte is received, then return it
+  int          availableForWrite();
+  
+  using Print::write;
+
+private:
+  int16_t room();                                            // room in the tx buffer, or -1 if unknown
+  
+  Stream& port;
+  int16_t maxFree;                                           // biggest room seen = empty tx buffer
+};
+
+
+/*************** SCoopADC SERVICE ******************/
+
+// scan a list of analog pins at a given period and push timestamped samples in a SCoopFifo per channel.
+// on AVR each conversion is started by the timer0 overflow (auto trigger, ~1ms) and the following channels of the
+// scan are chained from the conversion complete interrupt : no cpu time is spent waiting for the adc.
+// on ARM the adc is fast enough : the scan is done by analogRead() from an internal SCoopTimer.
+
+#if SCoopADCSCAN > 0
+
+struct SCoopADCSample_t { uint32_t micros; uint16_t value; };   // micros() at the begining of the scan
+
+#define defineADCFifo( name , number ) defineFifo( name , SCoopADCSample_t , number )
+
+class SCoopADCScan
+{public:
+  SCoopADCScan();
+  
+  int8_t addChannel(uint8_t pin, SCoopFifo& fifo, uint8_t oversampling = 0); // 2^oversampling conversions are averaged
+                                              // for each sample (0..6). return the channel index, or -1 if the list is full
+  void start(SCDelay_t periodMillis);         // start scanning the list, once per period
+  void stop();
+  bool running() { return active; }
+  
+  void waitSample(uint8_t index, SCoopADCSample_t* sample); // yield until the next sample of this channel is available
+  
+  vui16 overruns;                             // samples lost because the fifo was full
+  
+  void interrupt();                           // internal use : called by ISR(ADC_vect) on AVR, by the internal timer on ARM
+  
+private:
+  bool conversion(uint16_t value);            // store the result for the current channel. true when the scan is complete
+  void select(uint8_t index);                 // prepare the adc multiplexer for this channel
+
+  struct { uint8_t pin; uint8_t shift; SCoopFifo* fifo; } channel[SCoopADCSCAN];
+  uint8_t  channels;
+  vui8     current;                           // channel being converted
+  uint8_t  count;                             // conversions done for the current sample
+  uint16_t sum;                               // 64 * 1023 fits
+  uint32_t scanMicros;
+  volatile bool active;
+#if defined(SCoop_AVR)
+  volatile bool busy;                         // a scan is in progress
+  uint16_t period;                            // in timer0 overflows
+  uint16_t ticks;
+#else
+  SCoopTimer timer;
+#endif
+};
+
+extern SCoopADCScan SCoopADC;                 // there is only one adc
+
+#endif
+
+
+/*************** SCoopI2C SERVICE ******************/
+
+// queue of i2c transfers : a task fills a SCoopI2CTransfer, submit() it and continues, or calls transfer() which
+// yields until it is done. the next transfer of the queue is chained by the interrupt (stop + start), so
+// a display refresh and the sensor reads of other tasks can be queued together without blocking the scheduler.
+// each transfer writes writeLength bytes then, if readLength, reads with a repeated start. one of them can be 0.
+
+#if SCoopI2CQUEUE > 0
+
+#define SCoopI2CPENDING  0
+#define SCoopI2CDONE     1
+#define SCoopI2CNACK     2                   // no device at this address, or data refused
+#define SCoopI2CERROR    3                   // bus error or arbitration lost
+
+struct SCoopI2CTransfer
+{ uint8_t         address;                   // 7 bits
+  uint8_t         writeLength;
+  const uint8_t*  writeData;
+  uint8_t         readLength;
+  uint8_t*        readData;
+  volatile uint8_t status;                   // set to SCoopI2CPENDING by submit(). the descriptor must live until done
+};
+
+#if SCoopI2CSIM > 0
+class SCoopI2CDevice                         // model of an i2c slave, for SCoopI2CSIM
+{ public:
+  SCoopI2CDevice(uint8_t address);           // registered in the list of simulated devices
+  virtual void    start(bool read) { }       // (repeated) start addressed to this device
+  virtual bool    write(uint8_t value) { return true; } // byte received from the master. false = nack
+  virtual uint8_t read() { return 0xFF; }   // byte sent to the master
+  virtual void    stop() { }
+  uint8_t         address;
+  SCoopI2CDevice* next;
+};
+#endif
+
+class SCoopI2CBus
+{public:
+  SCoopI2CBus();
+  
+  void    begin(uint32_t clock = 100000);     // init the bus, 100 or 400khz
+  bool    submit(SCoopI2CTransfer& transfer); // queue the transfer and return imediately. false if the queue is full
+  uint8_t wait(SCoopI2CTransfer& transfer);   // yield until the transfer is done. return its status
+  uint8_t transfer(SCoopI2CTransfer& transfer); // submit (yield while the queue is full) then wait
+  
+  uint8_t write(uint8_t address, const uint8_t* data, uint8_t length);  // same, with a temporary descriptor
+  uint8_t read(uint8_t address, uint8_t reg, uint8_t* data, uint8_t length); // write the register index then read
+  
+  bool    idle() { return !busy; }
+  vui16   errors;                             // number of transfers ended with nack or error
+  
+  void    interrupt();                        // internal use : called by ISR(TWI_vect) or by yield() in simulation
+
+private:
+  void    startCurrent();
+  void    finish(uint8_t status);
+  
+  SCoopI2CTransfer* queue[SCoopI2CQUEUE];
+  vui8     queueIn;
+  vui8     queueOut;
+  SCoopI2CTransfer* volatile current;
+  uint8_t  index;                             // byte index in the current phase
+  volatile bool busy;
+#if SCoopI2CSIM > 0
+  uint32_t clock;
+  uint32_t startMicros;                       // when the current transfer started on the simulated bus
+  friend class SCoopI2CDevice;
+  SCoopI2CDevice* devices;
+#endif
+};
+
+extern SCoopI2CBus SCoopI2C;
+
+#endif
+
+#endif
 
->>>>>>> upstream/master
 
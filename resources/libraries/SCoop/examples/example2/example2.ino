@@ -143,8 +143,4 @@ TimerUp   T4;                            // from 0 to 1 billion every ms
 #endif
 		 }
   mySCoop.yield();     // switch to next elligible task or event or timer
-<<<<<<< HEAD
   }                
-=======
-  }                
->>>>>>> upstream/master
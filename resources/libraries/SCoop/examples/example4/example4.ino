@@ -17,8 +17,10 @@ defineFifo(fifo1,int16_t,200); // able to store 200ms of samples for Analog1 if
 
 defineFifo(fifo2,int16_t,20)   // 400ms max (20x20) for Analog2
 
+defineLog(log1,64);            // messages waiting for the logger task
+
 vui32 avgAna2 = 0;
-float scaleAna2=0.0;           // the real user value computed in an event
+SCoopShared<float> scaleAna2;  // the real user value computed in an event. read by task1 without tearing
 
 defineEventRun(event20ms)      // this event is trigger by the timer0 overflow interupt isr below
 { while (fifo2) { 
@@ -28,9 +30,8 @@ defineEventRun(event20ms)      // this event is trigger by the timer0 overflow i
  scaleAna2 = (avgAna2 / 16.0 * 1.75 + 0.25)/4.0;
 }
 
-vui32 count=0;
-
 ISR(TIMER0_COMPA_vect) {       // same rate as Timer0: every 1024us (16mhz)
+  static uint8_t count = 0;    // only seen by this isr, which is never interrupted : nothing to share
   fifo1.putInt(analogRead(1));
   count++; 
   if (count >= 20) { count =0; // every 20ms
@@ -38,25 +39,28 @@ ISR(TIMER0_COMPA_vect) {       // same rate as Timer0: every 1024us (16mhz)
      event20ms=true; } // trigger the event for further calculation
 }
 
-vi32 avgAna1;
+SCoopEMA avgAna1(4);           // exponential average over 16 samples, in fixed point
 defineTask(task1) // treat ana 1 : average mean over 16 last samples and print value every 500ms
 
-void task1::setup() { avgAna1=0; T500ms=0; }
+void task1::setup() { T500ms=0; }
 
 void task1::loop()  { 
-  if (fifo1) { int16_t val; fifo1.get(&val); avgAna1 += val - (avgAna1 >> 4); }
-  if (T500ms.rollOver()) {
-     SCp("avg ana1 = ");SCp(avgAna1 >> 4);  
-     SCp(", scaleAna2 = ");SCp(scaleAna2); 
+  avgAna1.run(fifo1);          // all the samples received since last cycle, in one block
+  if (T500ms.rollOver()) {     // only the raw values are recorded here, the text is printed by the logger task
+     SCoopLogPut(log1, "avg ana1 = %d, scaleAna2 = %f, stackleft = %u", avgAna1.value, SCoopLogFloat(scaleAna2), stackLeft());
 #if SCoopTIMEREPORT > 0
-     SCp(", cycle time = ");SCp((mySCoop.cycleMicros >> SCoopTIMEREPORT));
-	 SCp(", max = ");SCp((mySCoop.maxCycleMicros >> SCoopTIMEREPORT)); mySCoop.maxCycleMicros = 0;
+     SCoopLogPut(log1, "cycle time = %d, max = %d", (mySCoop.cycleMicros >> SCoopTIMEREPORT), 
+                 (mySCoop.maxCycleMicros >> SCoopTIMEREPORT)); mySCoop.maxCycleMicros = 0;
 #endif	 
-	 SCp(", stackleft = ");SCpln(stackLeft());
    }   
 }
 
 
+defineTaskLoop(logger)       // formatting and Serial output, away from the sampling task
+{ while (log1.print(Serial)) yield();
+  sleep(50); }
+
+
 void setup() { 
 
   SCbegin(57600); 
@@ -70,8 +74,4 @@ void setup() {
 
 void loop() { 
   }
-<<<<<<< HEAD
-
-=======
 
->>>>>>> upstream/master
@@ -16,6 +16,8 @@ defineFifo(fifo1,int16_t,20); // able to store 40ms of samples for Analog1 if ne
 
 defineFifo(fifo2,int16_t,20)  // 400ms max (20x20) for Analog2
 
+defineLog(log1,64);           // messages waiting for the logger task
+
 vui32 count=0;
 
 defineTimerRun(sampling,2)    // 2ms = 500hz right ?
@@ -41,20 +43,21 @@ void task1::loop()  {
      while (fifo2) { uint32_t val=fifo2.getInt(); avgAna2 += val - (avgAna2 >> 2); } // overage mean of the 4 last value
      scaleAna2 = (avgAna2 / 16.0 * 1.75 + 0.25)/4.0;  }
   
-  if (T500ms.rollOver()) {
-     SCp("avg ana1 = ");    
-	 SCp(avgAna1 >> 4);     
-     SCp(", scaleAna2 = "); 
-	 SCp(scaleAna2);        
-     
+  if (T500ms.rollOver()) {     // only the raw values are recorded here, the text is printed by the logger task
 #if SCoopTIMEREPORT > 0
-	 SCp(", cycle time = ");SCp((mySCoop.cycleMicros >> SCoopTIMEREPORT));
-	 SCp(", max time = ");SCp((mySCoop.maxCycleMicros ));mySCoop.maxCycleMicros =0;
+     SCoopLogPut(log1, "avg ana1 = %d, scaleAna2 = %f, cycle time = %d, max time = %d", avgAna1 >> 4, SCoopLogFloat(scaleAna2),
+                 (mySCoop.cycleMicros >> SCoopTIMEREPORT), mySCoop.maxCycleMicros); mySCoop.maxCycleMicros =0;
+#else
+     SCoopLogPut(log1, "avg ana1 = %d, scaleAna2 = %f", avgAna1 >> 4, SCoopLogFloat(scaleAna2));
 #endif
-     SCpln("");
    }   
 }
 
+
+defineTaskLoop(logger)       // formatting and Serial output, away from the sampling task
+{ while (log1.print(Serial)) yield();
+  sleep(50); }
+
 void setup() { 
 
   SCbegin(57600); 
@@ -67,8 +70,4 @@ void setup() {
 void loop() { 
   // nothing to do here then
 }
-<<<<<<< HEAD
-
-=======
 
->>>>>>> upstream/master
@@ -0,0 +1,278 @@
+
+//*** performance2 ***//
+// scheduler micro benchmark suite, generalizing performance1 :
+// - yield() cost without switch (quantum not reached) and with a switch (task -> main loop -> task)
+// - switch cost against the number of tasks (1 to 32, or as many as the RAM can allocate)
+// - event and timer dispatch cost by yield() against the number of items, idle and when they all fire
+// - SCoopFifo put()+get() cost against the item size
+// - sleep() wake up latency
+// - startLoop() cost, and kill() cost (SCoopANDROIDMODE >= 2) or delete cost (SCoopANDROIDMODE 1, as shipped)
+// results are printed as CSV on Serial. lines starting with # are comments. the suite runs BENCH_PASSES times, each
+// value is the median of the passes and is compared with the row recorded for this board in baseline.h
+//
+// also runs under simavr for an ATmega328 build, the program halts the cpu at the end :
+// simavr -m atmega328p -f 16000000 performance2.cpp.elf
+// or on a pc with the host port of the library : make -C extras/host bench
+
+#include <SCoop.h>
+#include "baseline.h"
+
+#if SCoopANDROIDMODE == 0
+#error "this benchmark needs SCoopANDROIDMODE >= 1 in SCoop.h, as it creates tasks with startLoop()"
+#endif
+
+#if defined(SCoop_AVR)
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#define benchReadByte(x)  pgm_read_byte(&(x))
+#define benchReadWord(x)  pgm_read_word(&(x))
+#define benchReadLong(x)  pgm_read_dword(&(x))
+#define BENCH_STACK       128        // small stacks, so that we can allocate more tasks on 2K RAM
+#define BENCH_PASSES      1          // simavr gives the same cycles each time, and a board is close to it
+#else
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#define benchReadByte(x)  (x)
+#define benchReadWord(x)  (x)
+#define benchReadLong(x)  (x)
+#if defined(SCoop_HOST)
+#define BENCH_STACK       1024       // x86-64 frames are larger
+#define BENCH_PASSES      9          // the os takes the cpu for a while now and then : the median ignores these passes
+#else
+#define BENCH_STACK       256
+#define BENCH_PASSES      3
+#endif
+#endif
+
+#define BENCH_MAX_TASKS   32
+#define BENCH_MAX_ITEMS   32
+#define BENCH_MAX_ROWS    64         // results kept for the median, when BENCH_PASSES > 1
+
+enum { BENCH_FIFO, BENCH_EVENT_IDLE, BENCH_EVENT_FIRE, BENCH_TIMER_IDLE, BENCH_YIELD_NOSWITCH, BENCH_YIELD_SWITCH,
+       BENCH_SWITCH_TASKS, BENCH_SLEEP_AVG, BENCH_SLEEP_MAX, BENCH_STARTLOOP, BENCH_KILL, BENCH_TIMER_FIRE, BENCH_DELETE,
+       BENCH_END = 0xFF };              // new tests are added at the end : the ids are recorded in baseline.h
+
+static const char benchNames[][16] PROGMEM = { "fifo_putget", "event_idle", "event_fire", "timer_idle", "yield_noswitch",
+       "yield_switch", "switch_tasks", "sleep_lat_avg", "sleep_lat_max", "startloop", "kill", "timer_fire", "delete" };
+
+struct benchBaseline_t { uint8_t test; uint16_t items; uint16_t size; uint32_t value; };
+
+static const benchBaseline_t benchBaseline[] PROGMEM = { BENCH_BASELINE_ROWS { BENCH_END, 0, 0, 0 } };
+
+uint32_t benchBaselineOf(uint8_t test, uint16_t items, uint16_t size)     // return 0 if no baseline recorded
+{ for (uint8_t i = 0; benchReadByte(benchBaseline[i].test) != BENCH_END; i++)
+    if ((benchReadByte(benchBaseline[i].test) == test) && (benchReadWord(benchBaseline[i].items) == items)
+        && (benchReadWord(benchBaseline[i].size) == size)) return benchReadLong(benchBaseline[i].value);
+  return 0; }
+
+uint8_t benchRegressions = 0;
+uint8_t benchPass, benchRow;                              // the rows come in the same order at each pass
+
+#if BENCH_PASSES > 1
+uint32_t benchValues[BENCH_MAX_ROWS][BENCH_PASSES];
+
+uint32_t benchMedian(uint32_t* values)                    // sorts the values
+{ for (uint8_t i = 1; i < BENCH_PASSES; i++) {
+     uint32_t v = values[i]; uint8_t j = i;
+     while ((j > 0) && (values[j - 1] > v)) { values[j] = values[j - 1]; j--; }
+     values[j] = v; }
+  return values[BENCH_PASSES / 2]; }
+#endif
+
+void benchReport(uint8_t test, uint16_t items, uint16_t size, uint32_t iterations, uint32_t value, const char* unit)
+{
+#if BENCH_PASSES > 1
+  if (benchRow >= BENCH_MAX_ROWS) return;
+  benchValues[benchRow][benchPass] = value;
+  if (benchPass < BENCH_PASSES - 1) { benchRow++; return; } // only the last pass prints, with the median of all the passes
+  value = benchMedian(benchValues[benchRow++]);
+#endif
+  for (uint8_t i = 0; i < sizeof(benchNames[0]); i++) { char c = benchReadByte(benchNames[test][i]); if (!c) break; SCp(c); }
+  SCp(",");SCp(test);SCp(",");SCp(items);SCp(",");SCp(size);SCp(",");SCp(iterations);SCp(",");SCp(value);SCp(",");SCp(unit);SCp(",");
+  uint32_t base = benchBaselineOf(test, items, size);
+  SCp(base);SCp(",");
+  if (base == 0)                                               { SCpln("new"); }
+  else if (value * 100 > base * (100 + BENCH_TOLERANCE) + 100) { SCpln("REGRESSION"); benchRegressions++; } // + 1 unit of rounding
+  else if (value * 100 + 100 < base * (100 - BENCH_TOLERANCE)) { SCpln("faster"); }
+  else                                                         { SCpln("ok"); }
+}
+
+uint32_t benchTime;                                       // start time of the running measurement, in micros()
+#define benchBegin()         (benchTime = micros())
+#define benchNs(iterations)  ((uint32_t)(((micros() - benchTime) * 1000UL) / (iterations)))
+
+
+/******** ITEMS AND TASKS USED BY THE MEASUREMENTS ********/
+
+void benchNop() { }
+
+vui32 benchCounter = 0;
+void benchCount() { benchCounter++; }                     // body of the tasks created for the switch measurements
+
+SCoopFunc_t benchJob = NULL;                              // piece of code to execute inside benchTask
+
+defineTaskLoop(benchTask) { if (benchJob) { benchJob(); benchJob = NULL; } }
+
+void benchInTask(SCoopFunc_t job)                         // run a job inside a task, and wait for its completion
+{ benchJob = job; benchTask.resume();
+  while (benchJob) mySCoop.yield();
+  benchTask.pause(); }
+
+#define N_YIELD 2000
+
+uint32_t benchResult;
+
+void jobYieldNoSwitch()
+{ micros_t quantum = benchTask.quantumMicros;
+  benchTask.quantumMicros = 30000;                        // longest quantum possible with 16 bits micros_t
+  benchTask.yield0();                                     // start with a fresh quantum
+  benchBegin();
+  for (uint16_t i = 0; i < N_YIELD; i++) benchTask.yield();
+  benchResult = benchNs(N_YIELD);
+  benchTask.quantumMicros = quantum; }
+
+void jobYieldSwitch()
+{ benchBegin();
+  for (uint16_t i = 0; i < N_YIELD; i++) benchTask.yield0(); // each one goes back to the main loop which comes back immediately
+  benchResult = benchNs(N_YIELD); }
+
+#define N_SLEEP 20
+uint16_t sleepMs;
+uint32_t sleepMax;
+
+void jobSleep()
+{ uint32_t total = 0; sleepMax = 0;
+  for (uint8_t i = 0; i < N_SLEEP; i++) {
+     uint32_t t0 = micros();
+     benchTask.sleep(sleepMs);
+     int32_t late = (int32_t)(micros() - t0) - (int32_t)sleepMs * 1000;
+     if (late < 0) late = 0;                              // sleep counts in whole millis() ticks, it can wake up early
+     total += late; if ((uint32_t)late > sleepMax) sleepMax = late; }
+  benchResult = total / N_SLEEP; }
+
+
+/******** MEASUREMENTS ********/
+
+uint8_t benchBuffer[8 * 32];
+
+void benchFifo()
+{ uint8_t item[32];
+  for (uint8_t size = 1; size <= 32; size <<= 1) {
+     SCoopFifo fifo(benchBuffer, size, 8);
+     benchBegin();
+     for (uint16_t i = 0; i < 1000; i++) { fifo.put(item); fifo.get(item); }
+     benchReport(BENCH_FIFO, 1, size, 1000, benchNs(1000), "ns"); } }
+
+void benchEvents()
+{ SCoopEvent* events[BENCH_MAX_ITEMS];
+  uint8_t n = 0;
+  for (uint8_t items = 0; items <= BENCH_MAX_ITEMS; items = (items ? items << 1 : 1)) {
+     while (n < items) { events[n] = new SCoopEvent(benchNop); if (!events[n]) break; events[n]->start(); n++; }
+     if (n < items) break;
+     benchBegin();
+     for (uint16_t i = 0; i < 1000; i++) mySCoop.yield();
+     benchReport(BENCH_EVENT_IDLE, items, 0, 1000, benchNs(1000), "ns");
+     benchBegin();
+     for (uint16_t i = 0; i < 1000; i++) { for (uint8_t j = 0; j < n; j++) events[j]->set(); mySCoop.yield(); }
+     benchReport(BENCH_EVENT_FIRE, items, 0, 1000, benchNs(1000), "ns"); }
+  while (n) delete events[--n]; }
+
+void benchTimers()                                        // the period is never reached : timer_fire makes them due
+{ SCoopTimer* timers[BENCH_MAX_ITEMS];
+  uint8_t n = 0;
+  for (uint8_t items = 0; items <= BENCH_MAX_ITEMS; items = (items ? items << 1 : 1)) {
+     while (n < items) { timers[n] = new SCoopTimer(30000, benchCount); if (!timers[n]) break; timers[n]->start(); n++; }
+     if (n < items) break;
+     benchBegin();
+     for (uint16_t i = 0; i < 1000; i++) mySCoop.yield();
+     benchReport(BENCH_TIMER_IDLE, items, 0, 1000, benchNs(1000), "ns");
+     benchCounter = 0;
+     benchBegin();
+     for (uint16_t i = 0; i < 1000; i++) { for (uint8_t j = 0; j < n; j++) timers[j]->setTimeToRun(0); mySCoop.yield(); }
+     uint32_t spent = benchNs(1000);
+     if (benchCounter != (uint32_t)items * 1000) { SCp("# only ");SCp(benchCounter);SCpln(" timer runs"); }
+     benchReport(BENCH_TIMER_FIRE, items, 0, 1000, spent, "ns"); }
+  while (n) delete timers[--n]; }
+
+void benchYield()
+{ benchInTask(jobYieldNoSwitch); benchReport(BENCH_YIELD_NOSWITCH, 1, 0, N_YIELD, benchResult, "ns");
+  benchInTask(jobYieldSwitch);   benchReport(BENCH_YIELD_SWITCH,   1, 0, N_YIELD, benchResult, "ns"); }
+
+void benchSleep()
+{ for (sleepMs = 1; sleepMs <= 10; sleepMs *= 10) {
+     benchInTask(jobSleep);
+     benchReport(BENCH_SLEEP_AVG, 1, sleepMs, N_SLEEP, benchResult, "us");
+     benchReport(BENCH_SLEEP_MAX, 1, sleepMs, N_SLEEP, sleepMax, "us"); } }
+
+#define N_START  4                                        // tasks started, then removed, together
+#define N_GROUPS 16                                       // micros() steps of 1 us spread over 64 tasks
+
+void benchStartKill()                                     // micros() is too coarse for one task : a group is timed
+{ SCoopTask* task[N_START]; uint32_t created = 0, removed = 0;
+  uint8_t before = SCoopNumberTask;
+  for (uint8_t group = 0; group < N_GROUPS; group++) {
+     benchBegin();
+     for (uint8_t i = 0; i < N_START; i++) task[i] = mySCoop.startLoop(benchNop, BENCH_STACK);
+     created += micros() - benchTime;
+     for (uint8_t i = 0; i < N_START; i++) if (!task[i]) { SCpln("# startLoop failed, not enough RAM"); return; }
+     mySCoop.yield();                                     // start the tasks, so that they are RUNNABLE before removing them
+     benchBegin();
+#if SCoopANDROIDMODE >= 2
+     for (uint8_t i = 0; i < N_START; i++) task[i]->kill();
+     while (SCoopNumberTask > before) mySCoop.yield();    // each one is deleted when the cycle reaches it
+#else
+     for (uint8_t i = 0; i < N_START; i++) delete task[i];
+#endif
+     removed += micros() - benchTime; }
+  benchReport(BENCH_STARTLOOP, 1, BENCH_STACK, N_GROUPS * N_START, created * 1000 / (N_GROUPS * N_START), "ns");
+#if SCoopANDROIDMODE >= 2
+  benchReport(BENCH_KILL,      1, BENCH_STACK, N_GROUPS * N_START, removed * 1000 / (N_GROUPS * N_START), "ns"); }
+#else
+  benchReport(BENCH_DELETE,    1, BENCH_STACK, N_GROUPS * N_START, removed * 1000 / (N_GROUPS * N_START), "ns"); }
+#endif
+
+void benchSwitch()                                        // the tasks are deleted at the end, for the next pass
+{ SCoopTask* tasks[BENCH_MAX_TASKS];
+  uint8_t n = 0;
+  for (uint8_t count = 1; count <= BENCH_MAX_TASKS; count <<= 1) {
+     while (n < count) { tasks[n] = mySCoop.startLoop(benchCount, BENCH_STACK); if (!tasks[n]) break; n++; }
+     if (n < count) { SCp("# startLoop failed after ");SCp(n);SCpln(" tasks, not enough RAM"); break; }
+     mySCoop.yield();                                     // start the new tasks
+     benchCounter = 0;
+     benchBegin();
+     for (uint16_t i = 0; i < 200; i++) mySCoop.yield();
+     uint32_t spent = micros() - benchTime;
+     benchReport(BENCH_SWITCH_TASKS, count, BENCH_STACK, benchCounter, (spent * 1000UL) / (benchCounter ? benchCounter : 1), "ns"); }
+  while (n) delete tasks[--n]; }
+
+
+void setup()
+{ SCbegin(57600);
+  mySCoop.start(0,0);                                     // no quantum: each yield() switches, no time spent in main loop
+  benchTask.pause();
+
+  SCp("# SCoop performance2 on ");SCp(BENCH_BOARD);SCp(" at F_CPU = ");SCpln(F_CPU);
+  SCpln("test,id,items,size,iterations,value,unit,baseline,status");
+
+  for (benchPass = 0; benchPass < BENCH_PASSES; benchPass++) {
+     benchRow = 0;
+     benchFifo();
+     benchEvents();
+     benchTimers();
+     benchYield();
+     benchSleep();
+     benchStartKill();
+     benchSwitch(); }
+
+  SCp("# done, regressions = ");SCpln(benchRegressions);
+  Serial.flush();
+#if defined(SCoop_AVR)
+  cli(); sleep_enable(); sleep_cpu();                     // simavr exits when the cpu sleeps with interrupts disabled
+#elif defined(SCoop_HOST)
+  exit(benchRegressions ? 1 : 0);                         // extras/host : make bench
+#endif
+  while (1);
+}
+
+void loop() { }
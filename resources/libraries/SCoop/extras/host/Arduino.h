@@ -0,0 +1,105 @@
+//*** minimal Arduino core for the host tests ***//
+// just what SCoop and the tests use : time from the os clock, Serial to stdout, no pin and no interrupt.
+// SCoop.h selects its SCoop_HOST port on x86-64. see Makefile
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef bool    boolean;
+typedef uint8_t byte;
+
+#define B00001  1
+#define B00010  2
+#define B00100  4
+#define B00101  5
+#define B00110  6
+#define B01000  8
+#define B10000  16
+#define B100000 32
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+#define DEC     10
+#define HEX     16
+#define A0      14
+#define LED_BUILTIN 13
+
+#ifndef F_CPU
+#define F_CPU   0L                     // unknown on a pc. only printed by the benchmarks
+#endif
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define pgm_read_byte(p)    (*(const uint8_t*)(p))
+#define pgm_read_word(p)    (*(const uint16_t*)(p))
+#define pgm_read_dword(p)   (*(const uint32_t*)(p))
+
+class __FlashStringHelper;
+#define F(s)                ((const __FlashStringHelper*)(s))
+
+#define min(a,b)            ((a)<(b)?(a):(b))
+#define max(a,b)            ((a)>(b)?(a):(b))
+
+uint32_t millis();                     // 32 bits, as on the boards
+uint32_t micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void noInterrupts();
+void interrupts();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int  digitalRead(uint8_t pin);
+int  analogRead(uint8_t pin);
+
+class Print
+{public:
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) { size_t n = 0; while (size--) n += write(*buffer++); return n; }
+  size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+  virtual int  availableForWrite() { return 0; }
+  virtual void flush() { }
+
+  size_t print(const __FlashStringHelper* s) { return print((const char*)s); }
+  size_t print(const char* s)                { return write(s); }
+  size_t print(char c)                       { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(int v, int base = DEC)        { return print((long)v, base); }
+  size_t print(unsigned v, int base = DEC)   { return print((unsigned long)v, base); }
+  size_t print(long v, int base = DEC)       { char s[24]; snprintf(s, sizeof(s), (base == HEX) ? "%lX" : "%ld", v); return print(s); }
+  size_t print(unsigned long v, int base = DEC) { char s[24]; snprintf(s, sizeof(s), (base == HEX) ? "%lX" : "%lu", v); return print(s); }
+  size_t print(double v, int digits = 2)     { char s[32]; snprintf(s, sizeof(s), "%.*f", digits, v); return print(s); }
+  size_t println()                           { return print("\r\n"); }
+  template <class T> size_t println(T v)              { size_t n = print(v); return n + println(); }
+  template <class T> size_t println(T v, int format)  { size_t n = print(v, format); return n + println(); }
+};
+
+class Stream : public Print
+{public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream    // writes to stdout, never receives anything
+{public:
+  void   begin(unsigned long) { }
+  operator bool() { return true; }
+  int    available() { return 0; }
+  int    read() { return -1; }
+  int    peek() { return -1; }
+  size_t write(uint8_t c) { return (putchar(c) == EOF) ? 0 : 1; }
+  int    availableForWrite() { return 63; }
+  void   flush() { fflush(stdout); }
+  using  Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,39 @@
+//*** minimal Arduino core for the host tests ***//
+// millis() and micros() count from the program start with the os monotonic clock.
+
+#include <Arduino.h>
+#include <time.h>
+
+HardwareSerial Serial;
+
+static uint64_t hostNanos()
+{ struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec; }
+
+static uint64_t hostStart = hostNanos();
+
+uint32_t millis() { return (uint32_t)((hostNanos() - hostStart) / 1000000ULL); }
+uint32_t micros() { return (uint32_t)((hostNanos() - hostStart) / 1000ULL); }
+
+void delay(unsigned long ms)
+{ uint32_t start = millis();
+  while (millis() - start < ms) ; }
+
+void delayMicroseconds(unsigned int us)
+{ uint32_t start = micros();
+  while (micros() - start < us) ; }
+
+void noInterrupts() { }
+void interrupts() { }
+void pinMode(uint8_t, uint8_t) { }
+void digitalWrite(uint8_t, uint8_t) { }
+int  digitalRead(uint8_t) { return LOW; }
+int  analogRead(uint8_t) { return 512; }
+
+void setup();
+void loop();
+
+int main()
+{ setup();
+  for (;;) loop(); }
@@ -0,0 +1,61 @@
+//*** i2c_sim ***//
+// SCoopI2C with SCoopI2CSIM : a sensor read by one task and a display refreshed by another share the queue,
+// while a third task must keep running. checks the data read, the nack of a missing device and the bus time.
+
+#include <Arduino.h>
+#include <SCoop.h>
+
+class Sensor : public SCoopI2CDevice            // register index written first, then auto increment on read
+{public:
+  Sensor() : SCoopI2CDevice(0x40) { }
+  void    start(bool read) { if (!read) first = true; }
+  bool    write(uint8_t value) { if (first) { reg = value; first = false; } return true; }
+  uint8_t read() { return reg++; }
+  uint8_t reg;
+  bool    first;
+} sensor;
+
+class Display : public SCoopI2CDevice           // counts the bytes received, refuses nothing
+{public:
+  Display() : SCoopI2CDevice(0x3C) { bytes = 0; }
+  bool    write(uint8_t value) { bytes++; return true; }
+  uint32_t bytes;
+} display;
+
+uint32_t reads = 0, badReads = 0, frames = 0, nacks = 0, ticks = 0;
+
+defineTaskLoop(sensorTask)
+{ uint8_t data[4];
+  if ((SCoopI2C.read(0x40, 10, data, 4) != SCoopI2CDONE) || (data[0] != 10) || (data[3] != 13)) badReads++;
+  reads++; }
+
+uint8_t frame[128];
+
+defineTaskLoop(displayTask)
+{ SCoopI2CTransfer part[4];                     // one frame sent as 4 queued transfers
+  for (uint8_t i = 0; i < 4; i++) {
+     part[i].address = 0x3C; part[i].writeData = frame; part[i].writeLength = 128; part[i].readLength = 0;
+     while (!SCoopI2C.submit(part[i])) yield(); }
+  for (uint8_t i = 0; i < 4; i++) SCoopI2C.wait(part[i]);
+  frames++;
+  if (SCoopI2C.write(0x22, frame, 1) == SCoopI2CNACK) nacks++; } // nobody at 0x22
+
+defineTaskLoop(tickTask) { ticks++; yield(); }
+
+void setup()
+{ SCoopI2C.begin(400000);
+  mySCoop.start(); }
+
+#define RUN_MS 500
+
+void loop()
+{ yield();
+  if (millis() < RUN_MS) return;
+  // 4 x 128 bytes at 400khz take about 12ms : around 30 frames in the run with the sensor reads. the last frame
+  // can be on the bus, and its nack not yet done
+  bool ok = (reads > 10) && (badReads == 0) && (frames >= 20) && (frames <= 45)
+         && (display.bytes >= frames * 512UL) && (display.bytes <= (frames + 1) * 512UL)
+         && (nacks + 1 >= frames) && (nacks <= frames) && (SCoopI2C.errors == nacks) && (ticks > 1000);
+  printf("reads=%u bad=%u frames=%u bytes=%u nacks=%u errors=%u ticks=%u : %s\n", reads, badReads, frames,
+         display.bytes, nacks, (unsigned)SCoopI2C.errors, ticks, ok ? "ok" : "FAILED");
+  exit(ok ? 0 : 1); }
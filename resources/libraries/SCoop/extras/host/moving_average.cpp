@@ -0,0 +1,21 @@
+//*** moving_average ***//
+// SCoopMovingAverage with a history of 1024 samples : the index must go through the whole history, so a step from 0
+// to 100 is only fully seen after 1024 samples. with an 8 bits index, it wrapped after 256 and the average was 25
+
+#include <Arduino.h>
+#include <SCoop.h>
+
+defineMovingAverage(average, 10)
+
+void setup() { }
+
+void loop()
+{ int16_t sample = 0;
+  bool ok = true;
+  for (uint16_t i = 0; i < 3000; i++) {
+     sample = (i < 1500) ? 0 : 100;
+     average.process(&sample, NULL, 1);
+     if (i == 1500 + 1022) ok = ok && (average.value < 100);   // one zero still in the history
+     if (i == 1500 + 1023) ok = ok && (average.value == 100); }
+  printf("average=%d : %s\n", average.value, ok ? "ok" : "FAILED");
+  exit(ok ? 0 : 1); }
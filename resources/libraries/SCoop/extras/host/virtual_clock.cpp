@@ -0,0 +1,33 @@
+//*** virtual_clock ***//
+// SCoopVIRTUALCLOCK with a main loop which only yields : the clock must jump from one deadline to the next,
+// so that 20 virtual seconds of timers and sleeping tasks take a few hundred turns of loop(), with exact counts.
+// without the jumps, each yield() only costs mySCoop.virtualCostMicros (10us) : 2 millions turns
+
+#include <Arduino.h>
+#include <SCoop.h>
+
+uint32_t timerRuns = 0, taskRuns = 0, lateWakeups = 0;
+
+defineTimerRun(tick, 100) { timerRuns++; }
+
+defineTaskLoop(sleeper)
+{ SCDelay_t before = SCoopDelayMillis();
+  sleep(250);
+  if (SCoopDelayMillis() - before != 250) lateWakeups++;   // woken exactly at its deadline, plus a few yield() costs
+  taskRuns++; }
+
+uint32_t loops = 0;
+
+void setup()
+{ mySCoop.start(); }
+
+#define RUN_MS 20000
+
+void loop()
+{ yield(); loops++;
+  if (SCoopDelayMillis() < RUN_MS) return;
+  bool ok = (timerRuns >= RUN_MS / 100 - 1) && (timerRuns <= RUN_MS / 100) && (taskRuns >= RUN_MS / 250 - 1)
+         && (taskRuns <= RUN_MS / 250) && (lateWakeups == 0) && (loops < 20000);
+  printf("virtual=%u ms loops=%u timer=%u task=%u late=%u : %s\n", (unsigned)SCoopDelayMillis(), loops, timerRuns,
+         taskRuns, lateWakeups, ok ? "ok" : "FAILED");
+  exit(ok ? 0 : 1); }
@@ -1,5 +1,17 @@
 #include "InsectBot.h"
 
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#endif
+
+/* Smoothstep easing curve 3t^2-2t^3 sampled on 33 points, 0..255 */
+static const uint8_t insectBotEase[33] PROGMEM =
+{
+    0,   1,   3,   6,  11,  17,  24,  31,  40,  49,  59,  70,  81,  92, 104, 116,
+  128, 139, 151, 163, 174, 185, 196, 206, 215, 224, 231, 238, 244, 249, 252, 254,
+  255
+};
+
 InsectBot::InsectBot(void)
 {
   walkSpeed = 500; // How long to wait between steps in milliseconds (change this to increase (-) or decrease (+) the walking speed)
@@ -18,6 +30,22 @@ InsectBot::InsectBot(void)
   /* Danger distance */
   dangerDistance = 350; 	// adjust the value + for decreasing the danger distance 
   isSetup = false;
+
+  distance = 0;
+  distanceAverage = 0;
+  distanceIndex = 0;
+  distanceValid = false;
+  distanceTime = 0;
+
+  frameCount = 0;
+  frameIndex = 0;
+  frameTick = 0;
+  framePhase = 0;
+  frameRate = 0;
+  frontPos = centerPos << 6;
+  rearPos = centerPos << 6;
+  queueIn = 0;
+  queueOut = 0;
 }
 
 void InsectBot::lazySetup()
@@ -34,93 +62,249 @@ void InsectBot::setup(void)
   frontServo.attach(9);
   rearServo.attach(10);
   pinMode(sensorPin, INPUT);
-  frontServo.write(centerPos);
-  rearServo.write(centerPos);
+  if (!distanceValid)
+  {
+    sample();                         // only once, so that getDistance() has a value before the first period
+  }
+  frontPos = centerPos << 6;
+  rearPos = centerPos << 6;
+  writeServos();
 }
 
-void InsectBot::updateDistance(void)
+static int median3(int a, int b, int c)
 {
-  lazySetup();
-  int i;
-  int distanceCollection[5];
-  int distanceCheck;
-
-  for (i=0; i<5; ++i)
+  if (a > b)
+  {
+    int t = a; a = b; b = t;
+  }
+  if (b > c)
   {
-    distanceCheck = analogRead(sensorPin);
-    distanceCollection[i] = distanceCheck;
+    b = c;
+  }
+  return (a > b) ? a : b;
+}
+
+void InsectBot::sample(void)
+{
+  int raw = analogRead(sensorPin);
+  distanceTime = millis();
 
+  if (!distanceValid)
+  {
+    distanceHistory[0] = raw;
+    distanceHistory[1] = raw;
+    distanceHistory[2] = raw;
+    distanceAverage = raw << 2;
+    distanceValid = true;
+  }
+  else
+  {
+    distanceHistory[distanceIndex] = raw;
+    distanceAverage += median3(distanceHistory[0], distanceHistory[1], distanceHistory[2]) - (distanceAverage >> 2);
+  }
+  if (++distanceIndex >= 3)
+  {
+    distanceIndex = 0;
   }
+  distance = distanceAverage >> 2;
+}
 
-  distance = (distanceCollection[0] + distanceCollection[1] + distanceCollection[2] + distanceCollection[3] + distanceCollection[4]) / 5;
-  delay(20);
+unsigned long InsectBot::distanceAge(void)
+{
+  return millis() - distanceTime;
 }
 
 int InsectBot::getDistance(void)
 {
   lazySetup();
-  updateDistance();
-
   return distance;
 }
 
 bool InsectBot::isInDanger(void)
+{
+  return (getDistance() > dangerDistance);
+}
+
+/* Gait sequencer */
+
+void InsectBot::setFrame(uint8_t i, uint8_t front, uint8_t rear, uint16_t duration)
+{
+  frames[i].front = front;
+  frames[i].rear = rear;
+  frames[i].duration = duration;
+}
+
+void InsectBot::loadMotion(uint8_t motion)
+{
+  switch (motion)
+  {
+    case INSECTBOT_FORWARD:
+      setFrame(0, frontRightUp, backLeftForward, INSECTBOT_LIFT_TIME);
+      setFrame(1, centerPos, centerPos, INSECTBOT_RETURN_TIME);
+      setFrame(2, frontLeftUp, backRightForward, INSECTBOT_LIFT_TIME);
+      setFrame(3, centerPos, centerPos, INSECTBOT_RETURN_TIME);
+      setFrame(4, centerPos, centerPos, walkSpeed);
+      frameCount = 5;
+      break;
+    case INSECTBOT_BACK_RIGHT:
+      setFrame(0, frontRightUp, backRightForward-6, INSECTBOT_LIFT_TIME);
+      setFrame(1, centerPos, centerPos-6, INSECTBOT_RETURN_TIME);
+      setFrame(2, frontLeftUp+9, backLeftForward-6, INSECTBOT_LIFT_TIME);
+      setFrame(3, centerPos, centerPos, INSECTBOT_RETURN_TIME);
+      frameCount = 4;
+      break;
+    case INSECTBOT_TURN_LEFT:
+      setFrame(0, frontTurnRightUp, backTurnLeftForward, INSECTBOT_LIFT_TIME);
+      setFrame(1, centerTurnPos, centerTurnPos, INSECTBOT_RETURN_TIME);
+      setFrame(2, frontTurnLeftUp, backTurnRightForward, INSECTBOT_LIFT_TIME);
+      setFrame(3, centerTurnPos, centerTurnPos, INSECTBOT_RETURN_TIME);
+      frameCount = 4;
+      break;
+    default:
+      frameCount = 0;
+      return;
+  }
+  frameIndex = 0;
+  startFrame();
+}
+
+void InsectBot::startFrame(void)
+{
+  uint16_t duration = frames[frameIndex].duration;
+
+  frontStart = frontPos;
+  rearStart = rearPos;
+  frontDelta = (frames[frameIndex].front << 6) - frontPos;
+  rearDelta = (frames[frameIndex].rear << 6) - rearPos;
+  framePhase = 0;
+  frameRate = duration ? ((0x10000UL + duration - 1) / duration) : 0x10000UL;  // only division, once per keyframe
+  frameTick = (uint16_t)millis();
+}
+
+void InsectBot::moveServos(uint16_t ease)
+{
+  frontPos = frontStart + (int)(((long)frontDelta * ease) >> 8);
+  rearPos = rearStart + (int)(((long)rearDelta * ease) >> 8);
+  writeServos();
+}
+
+void InsectBot::writeServos(void)
+{
+  // 1/64 degree to the 544..2400 us pulse range of the Servo library: 1856/180*64/4096 = 165/1024
+  frontServo.writeMicroseconds(544 + (int)(((long)frontPos * 165) >> 10));
+  rearServo.writeMicroseconds(544 + (int)(((long)rearPos * 165) >> 10));
+}
+
+bool InsectBot::queueMotion(uint8_t motion)
+{
+  uint8_t next = (queueIn + 1) & (INSECTBOT_QUEUE_SIZE - 1);
+  if (next == queueOut)
+  {
+    return false;
+  }
+  queue[queueIn] = motion;
+  queueIn = next;
+  return true;
+}
+
+void InsectBot::update(void)
 {
   lazySetup();
-  updateDistance();
-  return (distance > dangerDistance);
+  if (distanceAge() >= INSECTBOT_SAMPLE_PERIOD)
+  {
+    sample();
+  }
+  if (frameCount)
+  {
+    uint16_t now = (uint16_t)millis();
+    uint16_t elapsed = now - frameTick;
+    if (!elapsed)
+    {
+      return;
+    }
+    frameTick = now;
+    framePhase += elapsed * frameRate;
+    if (framePhase < 0x10000UL)
+    {
+      uint8_t index = (uint8_t)(framePhase >> 11);
+      uint8_t fraction = (uint8_t)(framePhase >> 3);
+      uint8_t a = pgm_read_byte(&insectBotEase[index]);
+      uint8_t b = pgm_read_byte(&insectBotEase[index + 1]);
+      moveServos(a + (((b - a) * fraction) >> 8));
+      return;
+    }
+    moveServos(256);                  // keyframe reached, land exactly on the target
+    if (++frameIndex < frameCount)
+    {
+      startFrame();
+      return;
+    }
+    frameCount = 0;
+  }
+  if (queueOut != queueIn)
+  {
+    uint8_t motion = queue[queueOut];
+    queueOut = (queueOut + 1) & (INSECTBOT_QUEUE_SIZE - 1);
+    loadMotion(motion);
+  }
 }
 
-void InsectBot::goForward(void)
+bool InsectBot::isBusy(void)
+{
+  return (frameCount != 0) || (queueOut != queueIn);
+}
+
+uint8_t InsectBot::queuedMotions(void)
+{
+  return (queueIn - queueOut) & (INSECTBOT_QUEUE_SIZE - 1);
+}
+
+void InsectBot::stop(void)
 {
   lazySetup();
-  frontServo.write(frontRightUp);
-  rearServo.write(backLeftForward);
-  delay(110);
-  frontServo.write(centerPos);
-  rearServo.write(centerPos);
-  delay(90);
-  frontServo.write(frontLeftUp);
-  rearServo.write(backRightForward);
-  delay(110);
-  frontServo.write(centerPos);
-  rearServo.write(centerPos);
-  delay(90);
-  delay(walkSpeed);
+  queueOut = queueIn;
+  frameCount = 0;
+  frontPos = centerPos << 6;
+  rearPos = centerPos << 6;
+  writeServos();
+}
+
+// the delay() of the old blocking moves called yield() on Arduino >= 1.5 : other tasks of a scheduler like SCoop
+// kept running during the whole gait. waiting for the sequencer must do the same
+static inline void insectBotYield(void)
+{
+#if ARDUINO >= 150
+  yield();
+#endif
+}
+
+void InsectBot::waitMotion(uint8_t motion)
+{
+  while (!queueMotion(motion))
+  {
+    update();
+    insectBotYield();
+  }
+  while (isBusy())
+  {
+    update();
+    insectBotYield();
+  }
+}
+
+void InsectBot::goForward(void)
+{
+  waitMotion(INSECTBOT_FORWARD);
 }
 
 void InsectBot::goBackRight(void)
 {
-  lazySetup();
-  frontServo.write(frontRightUp);
-  rearServo.write(backRightForward-6);
-  delay(110);
-  frontServo.write(centerPos);
-  rearServo.write(centerPos-6);
-  delay(90);
-  frontServo.write(frontLeftUp+9);
-  rearServo.write(backLeftForward-6);
-  delay(110);
-  frontServo.write(centerPos);
-  rearServo.write(centerPos);
-  delay(90);
+  waitMotion(INSECTBOT_BACK_RIGHT);
 }
 
 void InsectBot::turnLeft(void)
 {
-  lazySetup();
-  frontServo.write(frontTurnRightUp);
-  rearServo.write(backTurnLeftForward);
-  delay(110);
-  frontServo.write(centerTurnPos);
-  rearServo.write(centerTurnPos);
-  delay(90);
-  frontServo.write(frontTurnLeftUp);
-  rearServo.write(backTurnRightForward);
-  delay(110);
-  frontServo.write(centerTurnPos);
-  rearServo.write(centerTurnPos);
-  delay(90);
+  waitMotion(INSECTBOT_TURN_LEFT);
 }
 
 void InsectBot::blinkLed(void)
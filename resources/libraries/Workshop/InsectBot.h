@@ -13,6 +13,25 @@
 
 #include <Servo.h>
 
+#define INSECTBOT_FORWARD     0       // motion identifiers accepted by queueMotion()
+#define INSECTBOT_BACK_RIGHT  1
+#define INSECTBOT_TURN_LEFT   2
+
+#define INSECTBOT_MAX_FRAMES  5       // keyframes per motion
+#define INSECTBOT_QUEUE_SIZE  8       // pending motions, must be a power of 2
+
+#define INSECTBOT_LIFT_TIME   110     // time to ease the servos into a lifted leg position, same as the old jump and wait
+#define INSECTBOT_RETURN_TIME 90      // time to ease the servos back to center, same as the old jump and wait
+
+#define INSECTBOT_SAMPLE_PERIOD 10    // background distance sampling period in milliseconds
+
+struct InsectBotFrame                 // one gait keyframe: servo targets and the time to ease into them
+{
+  uint8_t  front;
+  uint8_t  rear;
+  uint16_t duration;                  // in milliseconds
+};
+
 class InsectBot
 {
 private:
@@ -35,21 +54,66 @@ private:
   /* Danger distance */
   int dangerDistance; 	// adjust the value + for decreasing the danger distance 
 
-  int distance;
-  void updateDistance(void);
+  /* Distance sampler - median of 3 raw readings then exponential average over 4 samples */
+  int distance;                       // filtered value returned by getDistance()
+  int distanceAverage;                // exponential average, scaled by 4
+  int distanceHistory[3];             // last raw readings for the median filter
+  uint8_t distanceIndex;
+  bool distanceValid;                 // false until the first sample is taken
+  unsigned long distanceTime;         // millis() of the last sample
   
   bool isSetup;
   void setup(void);
   void lazySetup();
+
+  /* Gait sequencer - keyframe table of the running motion and queue of the next ones */
+  InsectBotFrame frames[INSECTBOT_MAX_FRAMES];
+  uint8_t  frameCount;                // number of keyframes loaded for the running motion, 0 when idle
+  uint8_t  frameIndex;                // keyframe currently reached for
+  uint16_t frameTick;                 // millis() (16 bits) of the last interpolation step
+  uint32_t framePhase;                // progress through the keyframe, 0x10000 when reached
+  uint32_t frameRate;                 // phase increment per millisecond
+
+  /* Servo positions in 1/64 degree, interpolated from the Start position by Delta along the easing curve */
+  int frontPos;
+  int rearPos;
+  int frontStart;
+  int rearStart;
+  int frontDelta;
+  int rearDelta;
+  uint8_t  queue[INSECTBOT_QUEUE_SIZE];
+  uint8_t  queueIn;
+  uint8_t  queueOut;
+
+  void setFrame(uint8_t i, uint8_t front, uint8_t rear, uint16_t duration);
+  void loadMotion(uint8_t motion);
+  void startFrame(void);
+  void moveServos(uint16_t ease);
+  void writeServos(void);
+  void waitMotion(uint8_t motion);
   
 public:
   InsectBot(void);
 
-  int getDistance(void);
+  /* Non blocking gait engine: queue motions then call update() from loop() or a scheduler timer */
+  bool queueMotion(uint8_t motion);   // return false if the queue is full
+  void update(void);                  // advance the running motion and the distance sampler, return immediately
+  bool isBusy(void);                  // true while a motion is running or queued
+  bool isDone(void) { return !isBusy(); }
+  uint8_t queuedMotions(void);        // number of motions waiting behind the running one
+  void stop(void);                    // drop the queue and put both servos back to center
+
+  /* Distance sampler: sample() every INSECTBOT_SAMPLE_PERIOD ms from a timer, for example a SCoop timer :
+       defineTimerRun(insectSampler, INSECTBOT_SAMPLE_PERIOD) { insect.sample(); }
+     update() also samples at this period, for a sketch which runs the gait engine itself */
+  void sample(void);                  // one analogRead() through the filter
+  int getDistance(void);              // filtered value, never waits for the adc
 
   bool isInDanger(void);
 
-  void goForward(void);
+  unsigned long distanceAge(void);    // milliseconds since the distance was last sampled
+
+  void goForward(void);               // blocking wrappers: queue the motion and run it to the end
   void goBackRight(void);
   void turnLeft(void);
 
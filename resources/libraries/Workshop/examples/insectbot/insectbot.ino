@@ -1,11 +1,18 @@
 #include <Servo.h>
 #include "InsectBot.h"
+#include <SCoop.h>
 
 InsectBot insect;
+defineTimerRun(insectSampler, INSECTBOT_SAMPLE_PERIOD)
+{
+insect.sample();
+}
+
 int _ABVAR_1_a;
 
 void setup()
 {
+  mySCoop.start();
 }
 
 void loop()
@@ -23,6 +30,7 @@ void loop()
   {
     insect.goForward();
   }
+  yield();
 }
 
 
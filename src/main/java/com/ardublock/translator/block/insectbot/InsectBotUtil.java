@@ -10,5 +10,12 @@ public class InsectBotUtil
 		translator.addHeaderFile("InsectBot.h");
 		
 		translator.addDefinitionCommand("InsectBot insect;");
+		
+		// the distance is sampled by a SCoop timer, at each yield() : getDistance() only returns the filtered value.
+		// the loop of a scoop program ends with yield(), the moves and delay() yield too
+		translator.addHeaderFile("SCoop.h");
+		translator.addDefinitionCommand("defineTimerRun(insectSampler, INSECTBOT_SAMPLE_PERIOD)\n{\ninsect.sample();\n}\n");
+		translator.addSetupCommand("mySCoop.start();");
+		translator.setScoopProgram(true);
 	}
 }
@@ -21,8 +21,8 @@ public class SCoopLoopBlock extends TranslatorBlock
 		translator.addHeaderFile("SCoop.h");
 		translator.addSetupCommand("mySCoop.start();");
 		
-		String taskName = SCoopTaskBlock.createScoopTaskName();
-		ret = "defineTaskLoop(" + taskName + ")\n"
+		String taskName = SCoopTaskBlock.createScoopTaskName(blockId);
+		ret = "defineTaskLoop(" + taskName + SCoopTaskBlock.getStackSizeArgument(translator, taskName) + ")\n"
 				+ "{\n";
 		TranslatorBlock translatorBlock = getTranslatorBlockAtSocket(0);
 		while (translatorBlock != null)
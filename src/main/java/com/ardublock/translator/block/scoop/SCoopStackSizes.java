@@ -0,0 +1,137 @@
+package com.ardublock.translator.block.scoop;
+
+import java.io.BufferedReader;
+import java.io.File;
+import java.io.FileReader;
+import java.io.IOException;
+import java.util.HashMap;
+import java.util.Map;
+import java.util.regex.Matcher;
+import java.util.regex.Pattern;
+
+import com.ardublock.translator.Translator;
+
+// stack size of each generated task, read from "<program>.stack" next to the saved .abp file. ardublock does not
+// compile the sketch, so this file is written by hand. it can contain the .su lines written by the compiler with
+// -fstack-usage (add the flag to compiler.cpp.flags in platform.txt, build, then copy the lines of the sketch .su file
+// from the build folder) and/or lines printed by the sketch itself, for example from its loop() after a while :
+//   scoopTask57 stackLeft 37 of 150
+// tasks are named after their block id (see SCoopTaskBlock.createScoopTaskName), so the lines stay valid when other
+// tasks are added or removed. tasks without information keep SCoopDefaultStackSize.
+//
+// a .su line only gives the frame of the task setup() or loop() itself, not the functions they call, the context
+// switch or an interrupt. the board is not known here : the size is generated as SCoopFrameStackSize(frame), which
+// adds the SCoopStackMargin of the platform and is never less than SCoopDefaultStackSize. a stackLeft line is a
+// high water mark measured on the board, with all of this included : it is used as it is, with a small margin, and
+// wins over the .su line.
+public class SCoopStackSizes
+{
+	public static final String STACK_FRAMES = "scoop_stack_frames";
+	public static final String STACK_SIZES = "scoop_stack_sizes";
+
+	// stackLeft() is measured on the board, it only needs room for a peak not seen yet
+	public static final int STACK_LEFT_MARGIN = 32;
+	public static final int MIN_STACK_SIZE = 64;
+
+	private static final Pattern STACK_USAGE_PATTERN = Pattern.compile("\\b(scoopTask\\d+)::(?:setup|loop)\\(\\)\\s+(\\d+)\\s+\\S+");
+	private static final Pattern STACK_LEFT_PATTERN = Pattern.compile("\\b(scoopTask\\d+)\\s+stackLeft\\s*[=:]?\\s*(\\d+)\\s+(?:of|size)\\s*[=:]?\\s*(\\d+)");
+
+	public static void load(Translator translator, String programPath)
+	{
+		if (programPath == null)
+		{
+			return ;
+		}
+		int dot = programPath.lastIndexOf('.');
+		if (dot > programPath.lastIndexOf(File.separatorChar))
+		{
+			programPath = programPath.substring(0, dot);
+		}
+		File stackFile = new File(programPath + ".stack");
+		if (!stackFile.exists())
+		{
+			return ;
+		}
+
+		Map<String, Integer> frames = new HashMap<String, Integer>();
+		Map<String, Integer> sizes = new HashMap<String, Integer>();
+		BufferedReader reader = null;
+		try
+		{
+			reader = new BufferedReader(new FileReader(stackFile));
+			String line;
+			while ((line = reader.readLine()) != null)
+			{
+				Matcher m = STACK_USAGE_PATTERN.matcher(line);
+				if (m.find())
+				{
+					putLargest(frames, m.group(1), Integer.parseInt(m.group(2)));
+					continue;
+				}
+				m = STACK_LEFT_PATTERN.matcher(line);
+				if (m.find())
+				{
+					int used = Integer.parseInt(m.group(3)) - Integer.parseInt(m.group(2));
+					putSize(sizes, m.group(1), used + STACK_LEFT_MARGIN);
+				}
+			}
+		}
+		catch (IOException e)
+		{
+			e.printStackTrace();
+		}
+		catch (NumberFormatException e)
+		{
+			e.printStackTrace();
+		}
+		finally
+		{
+			if (reader != null)
+			{
+				try
+				{
+					reader.close();
+				}
+				catch (IOException e)
+				{
+					e.printStackTrace();
+				}
+			}
+		}
+		translator.addInternalData(STACK_FRAMES, frames);
+		translator.addInternalData(STACK_SIZES, sizes);
+	}
+
+	// rounded to 8 for the ARM stacks
+	private static void putSize(Map<String, Integer> sizes, String taskName, int size)
+	{
+		putLargest(sizes, taskName, (Math.max(size, MIN_STACK_SIZE) + 7) & ~7);
+	}
+
+	// when several lines give a size for the same task, the largest is kept
+	private static void putLargest(Map<String, Integer> sizes, String taskName, int size)
+	{
+		Integer previous = sizes.get(taskName);
+		if (previous == null || previous.intValue() < size)
+		{
+			sizes.put(taskName, Integer.valueOf(size));
+		}
+	}
+
+	// the stack size argument of defineTask, or null to keep SCoopDefaultStackSize
+	@SuppressWarnings("unchecked")
+	public static String getStackSize(Translator translator, String taskName)
+	{
+		Map<String, Integer> sizes = (Map<String, Integer>)translator.getInternalData(STACK_SIZES);
+		if (sizes != null && sizes.containsKey(taskName))
+		{
+			return sizes.get(taskName).toString();
+		}
+		Map<String, Integer> frames = (Map<String, Integer>)translator.getInternalData(STACK_FRAMES);
+		if (frames != null && frames.containsKey(taskName))
+		{
+			return "SCoopFrameStackSize(" + frames.get(taskName) + ")";
+		}
+		return null;
+	}
+}
@@ -1,5 +1,8 @@
 package com.ardublock.translator.block.scoop;
 
+import java.util.regex.Matcher;
+import java.util.regex.Pattern;
+
 import com.ardublock.translator.Translator;
 import com.ardublock.translator.block.TranslatorBlock;
 import com.ardublock.translator.block.exception.SocketNullException;
@@ -25,15 +28,102 @@ public class SCoopTaskBlock extends TranslatorBlock
 		}
 		
 		StringBuffer loopCodeBuffer = new StringBuffer();
+		TranslatorBlock lastBlock = null;
+		String lastCode = "";
 		translatorBlock = getTranslatorBlockAtSocket(1);
 		while (translatorBlock != null)
 		{
-			loopCodeBuffer.append(translatorBlock.toCode());
+			lastCode = translatorBlock.toCode();
+			loopCodeBuffer.append(lastCode);
+			lastBlock = translatorBlock;
 			translatorBlock = translatorBlock.nextTranslatorBlock();
 		}
 		
+		if (lastBlock instanceof SCoopSleepBlock)
+		{
+			String runCommand = loopCodeBuffer.substring(0, loopCodeBuffer.length() - lastCode.length());
+			String period = getTimerPeriod(lastCode, runCommand);
+			if (period != null)
+			{
+				return generateScoopTimer(setupCodeBuffer.toString(), runCommand, period);
+			}
+		}
+		
 		return generateScoopTask(setupCodeBuffer.toString(), loopCodeBuffer.toString());
 	}
+	
+	private static final Pattern SLEEP_PATTERN = Pattern.compile("^\\s*sleep\\(\\s*(\\d{1,9})[uUlL]*\\s*\\);\\s*$");
+	private static final Pattern BLOCKING_PATTERN = Pattern.compile("\\b(sleep|delay|yield|while|pulseIn)\\s*\\(|\\bdo\\b|mySCoop\\.");
+	private static final Pattern CALL_PATTERN = Pattern.compile("\\b([A-Za-z_][A-Za-z0-9_]*)\\s*\\(");
+	
+	// a loop "do something; sleep(N)" can run as a timer with a period of N ms : no stack and no context switch.
+	// the first run is at the first yield(), as the first loop of the task. after that, the timing is not exactly the
+	// same : the task waited N ms after the end of each loop (fixed delay, a cycle lasts N ms plus the time of the
+	// loop), the timer is due every N ms from its start (fixed rate). a timer launched late, after a long blocking call
+	// elsewhere, runs again at each yield() until it has caught up with the missed periods.
+	// only if N is a constant and nothing else in the loop can wait. user subroutines are not translated yet, so
+	// a call to one of them keeps the task.
+	String getTimerPeriod(String sleepCommand, String runCommand)
+	{
+		Matcher sleepMatcher = SLEEP_PATTERN.matcher(sleepCommand);
+		if (!sleepMatcher.matches() || Long.parseLong(sleepMatcher.group(1)) == 0)
+		{
+			return null;
+		}
+		if (BLOCKING_PATTERN.matcher(runCommand).find())
+		{
+			return null;
+		}
+		Matcher callMatcher = CALL_PATTERN.matcher(runCommand);
+		while (callMatcher.find())
+		{
+			if (translator.containFunctionName(callMatcher.group(1)))
+			{
+				return null;
+			}
+		}
+		return sleepMatcher.group(1);
+	}
+	
+	String generateScoopTimer(String setupCommand, String runCommand, String period)
+	{
+		translator.addHeaderFile("SCoop.h");
+		translator.addSetupCommand("mySCoop.start();");
+		
+		String ret;
+		
+		String timerName = SCoopTaskBlock.createScoopTaskName(blockId);
+		// the task ran its loop at the first yield(), a timer would wait one period first : started due now
+		ret = "defineTimerBegin(" + timerName + ", " + period + ")\n"
+				+ "void start() { SCoopTimer::start(); setTimeToRun(0); }\n";
+		if (setupCommand.trim().length() == 0)
+		{
+			ret = ret + "void run();\n"
+					+ "defineTimerEnd(" + timerName + ")\n"
+					+ "void " + timerName + "::run()\n"
+					+ "{\n";
+		}
+		else
+		{
+			ret = ret + "void setup();\n"
+					+ "void run();\n"
+					+ "defineTimerEnd(" + timerName + ")\n"
+					+ "void " + timerName + "::setup()\n"
+					+ "{\n";
+			
+			ret = ret + setupCommand;
+			
+			ret = ret + "}\n\n"
+					+ "void " + timerName + "::run()\n"
+					+ "{\n";
+		}
+		
+		ret = ret + runCommand;
+		
+		ret = ret + "}\n\n";
+		
+		return ret;
+	}
 
 	String generateScoopTask(String setupCommand, String loopCommand)
 	{
@@ -44,8 +134,8 @@ public class SCoopTaskBlock extends TranslatorBlock
 		String ret;
 		
 		
-		String taskName = SCoopTaskBlock.createScoopTaskName();
-		ret = "defineTask(" + taskName + ")\n"
+		String taskName = SCoopTaskBlock.createScoopTaskName(blockId);
+		ret = "defineTask(" + taskName + getStackSizeArgument(translator, taskName) + ")\n"
 				+ "void " + taskName + "::setup()\n"
 				+ "{\n";
 		
@@ -62,12 +152,21 @@ public class SCoopTaskBlock extends TranslatorBlock
 		return ret;
 	}
 	
-	private static int taskId = 0;
-
-	public static String createScoopTaskName()
+	// named after the block id, which is saved in the .abp file : the name in a .stack file written for a previous
+	// build still refers to the same block, even after other tasks were added, removed or moved
+	public static String createScoopTaskName(Long blockId)
 	{
-		++taskId;
-		return "scoopTask" + taskId;
+		return "scoopTask" + blockId;
+	}
+	
+	public static String getStackSizeArgument(Translator translator, String taskName)
+	{
+		String stackSize = SCoopStackSizes.getStackSize(translator, taskName);
+		if (stackSize == null)
+		{
+			return "";
+		}
+		return ", " + stackSize;
 	}
 
 }
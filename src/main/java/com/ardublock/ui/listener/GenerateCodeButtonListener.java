@@ -3,6 +3,7 @@ package com.ardublock.ui.listener;
 import java.awt.event.ActionEvent;
 import java.awt.event.ActionListener;
 import java.util.HashSet;
+import java.util.LinkedHashSet;
 import java.util.ResourceBundle;
 import java.util.Set;
 
@@ -16,6 +17,7 @@ import com.ardublock.translator.block.exception.BlockException;
 import com.ardublock.translator.block.exception.SocketNullException;
 import com.ardublock.translator.block.exception.SubroutineNameDuplicatedException;
 import com.ardublock.translator.block.exception.SubroutineNotDeclaredException;
+import com.ardublock.translator.block.scoop.SCoopStackSizes;
 
 import edu.mit.blocks.codeblocks.Block;
 import edu.mit.blocks.renderable.RenderableBlock;
@@ -42,12 +44,13 @@ public class GenerateCodeButtonListener implements ActionListener
 		success = true;
 		Translator translator = new Translator(workspace);
 		translator.reset();
+		SCoopStackSizes.load(translator, context.getSaveFilePath());
 		
 		Iterable<RenderableBlock> renderableBlocks = workspace.getRenderableBlocks();
 		
 		Set<RenderableBlock> loopBlockSet = new HashSet<RenderableBlock>();
 		Set<RenderableBlock> subroutineBlockSet = new HashSet<RenderableBlock>();
-		Set<RenderableBlock> scoopBlockSet = new HashSet<RenderableBlock>();
+		Set<RenderableBlock> scoopBlockSet = new LinkedHashSet<RenderableBlock>(); // workspace order : stable task names
 		Set<RenderableBlock> guinoBlockSet = new HashSet<RenderableBlock>();
 		StringBuilder code = new StringBuilder();
 		
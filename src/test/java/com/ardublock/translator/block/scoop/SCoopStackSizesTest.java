@@ -0,0 +1,63 @@
+package com.ardublock.translator.block.scoop;
+
+import static org.testng.Assert.assertEquals;
+import static org.testng.Assert.assertNull;
+
+import java.io.File;
+import java.io.FileWriter;
+import java.io.IOException;
+
+import org.testng.annotations.*;
+
+import com.ardublock.translator.Translator;
+
+public class SCoopStackSizesTest
+{
+	private File programFile;
+	private File stackFile;
+	private Translator translator;
+
+	@BeforeMethod
+	public void setUp() throws IOException
+	{
+		programFile = File.createTempFile("scoop", ".abp");
+		String path = programFile.getPath();
+		stackFile = new File(path.substring(0, path.length() - 4) + ".stack");
+		FileWriter writer = new FileWriter(stackFile);
+		writer.write("sketch.cpp:12:6:void scoopTask1::loop()\t40\tstatic\n");
+		writer.write("sketch.cpp:8:6:void scoopTask1::setup()\t12\tstatic\n");
+		writer.write("sketch.cpp:20:6:void scoopTask2::loop()\t40\tstatic\n");
+		writer.write("scoopTask2 stackLeft 100 of 150\n");
+		writer.write("scoopTask3 stackLeft 37 of 150\n");
+		writer.close();
+		translator = new Translator(null);
+		SCoopStackSizes.load(translator, path);
+	}
+
+	@AfterMethod
+	public void tearDown()
+	{
+		stackFile.delete();
+		programFile.delete();
+	}
+
+	@Test
+	public void testFrameKeepsThePlatformFloor()
+	{
+		assertEquals(SCoopStackSizes.getStackSize(translator, "scoopTask1"), "SCoopFrameStackSize(40)");
+	}
+
+	@Test
+	public void testMeasuredSizeWins()
+	{
+		assertEquals(SCoopStackSizes.getStackSize(translator, "scoopTask2"), "88");
+		assertEquals(SCoopStackSizes.getStackSize(translator, "scoopTask3"), "152");
+	}
+
+	@Test
+	public void testUnknownTask()
+	{
+		assertNull(SCoopStackSizes.getStackSize(translator, "scoopTask4"));
+		assertEquals(SCoopTaskBlock.getStackSizeArgument(translator, "scoopTask4"), "");
+	}
+}
@@ -0,0 +1,88 @@
+package com.ardublock.translator.block.scoop;
+
+import static org.testng.Assert.assertEquals;
+import static org.testng.Assert.assertNull;
+
+import org.testng.annotations.*;
+
+import com.ardublock.translator.Translator;
+import com.ardublock.translator.block.exception.SubroutineNameDuplicatedException;
+
+public class SCoopTaskBlockTest
+{
+	private Translator translator;
+	private SCoopTaskBlock taskBlock;
+
+	@BeforeMethod
+	public void setUp() throws SubroutineNameDuplicatedException
+	{
+		translator = new Translator(null);
+		translator.addFunctionName(Long.valueOf(2), "blink");
+		taskBlock = new SCoopTaskBlock(Long.valueOf(1), translator, "", "", "scoop task");
+	}
+
+	@Test
+	public void testConstantSleep()
+	{
+		assertEquals(taskBlock.getTimerPeriod("sleep(100);\n", "digitalWrite(13, HIGH);\n"), "100");
+		assertEquals(taskBlock.getTimerPeriod("sleep( 250UL );\n", "digitalWrite(13, HIGH);\n"), "250");
+		assertEquals(taskBlock.getTimerPeriod("sleep(100);\n", ""), "100");
+	}
+
+	@Test
+	public void testNonConstantSleep()
+	{
+		assertNull(taskBlock.getTimerPeriod("sleep(0);\n", "digitalWrite(13, HIGH);\n"));
+		assertNull(taskBlock.getTimerPeriod("sleep(_ABVAR_1_period);\n", "digitalWrite(13, HIGH);\n"));
+		assertNull(taskBlock.getTimerPeriod("sleep(100 * 2);\n", "digitalWrite(13, HIGH);\n"));
+		assertNull(taskBlock.getTimerPeriod("mySCoop.sleep(100);\n", "digitalWrite(13, HIGH);\n"));
+	}
+
+	@Test
+	public void testBlockingCalls()
+	{
+		assertNull(taskBlock.getTimerPeriod("sleep(100);\n", "sleep(10);\n"));
+		assertNull(taskBlock.getTimerPeriod("sleep(100);\n", "delay(10);\n"));
+		assertNull(taskBlock.getTimerPeriod("sleep(100);\n", "yield();\n"));
+		assertNull(taskBlock.getTimerPeriod("sleep(100);\n", "mySCoop.yield();\n"));
+		assertNull(taskBlock.getTimerPeriod("sleep(100);\n", "while (digitalRead(2)) {\n}\n"));
+		assertNull(taskBlock.getTimerPeriod("sleep(100);\n", "do {\n} while (digitalRead(2));\n"));
+		assertNull(taskBlock.getTimerPeriod("sleep(100);\n", "_ABVAR_1_t = pulseIn(2, HIGH);\n"));
+	}
+
+	@Test
+	public void testSubroutineCalls()
+	{
+		assertNull(taskBlock.getTimerPeriod("sleep(100);\n", "blink();\n"));
+		assertNull(taskBlock.getTimerPeriod("sleep(100);\n", "digitalWrite(13, HIGH);\nblink ();\n"));
+		assertEquals(taskBlock.getTimerPeriod("sleep(100);\n", "blinker();\n"), "100");
+	}
+
+	@Test
+	public void testTimerFirstRunAtStart()
+	{
+		assertEquals(taskBlock.generateScoopTimer("", "digitalWrite(13, HIGH);\n", "100"),
+				"defineTimerBegin(scoopTask1, 100)\n"
+				+ "void start() { SCoopTimer::start(); setTimeToRun(0); }\n"
+				+ "void run();\n"
+				+ "defineTimerEnd(scoopTask1)\n"
+				+ "void scoopTask1::run()\n"
+				+ "{\n"
+				+ "digitalWrite(13, HIGH);\n"
+				+ "}\n\n");
+		assertEquals(taskBlock.generateScoopTimer("pinMode(13, OUTPUT);\n", "digitalWrite(13, HIGH);\n", "100"),
+				"defineTimerBegin(scoopTask1, 100)\n"
+				+ "void start() { SCoopTimer::start(); setTimeToRun(0); }\n"
+				+ "void setup();\n"
+				+ "void run();\n"
+				+ "defineTimerEnd(scoopTask1)\n"
+				+ "void scoopTask1::setup()\n"
+				+ "{\n"
+				+ "pinMode(13, OUTPUT);\n"
+				+ "}\n\n"
+				+ "void scoopTask1::run()\n"
+				+ "{\n"
+				+ "digitalWrite(13, HIGH);\n"
+				+ "}\n\n");
+	}
+}